@@ -0,0 +1,357 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "interval_map_treap.hpp"
+#include "interval_segments.hpp"
+
+// Aggregates for augmented_interval_map. A monoid tells the map how to
+// summarise segments:
+//
+//   using value_type = ...;
+//   static value_type identity();
+//   static value_type segment(K const& keyBegin, K const& keyEnd, V const& val);
+//   static value_type combine(value_type const& a, value_type const& b);
+//
+// combine must be associative with identity as its neutral element, and is
+// always called with a summarising segments before those of b.
+
+// Sum of value * length, for arithmetic keys and values
+template<typename K, typename V>
+struct weighted_sum {
+  using value_type = double;
+
+  static value_type identity() { return 0; }
+  static value_type segment(K const& keyBegin, K const& keyEnd, V const& val) {
+    return double(val) * (double(keyEnd) - double(keyBegin));
+  }
+  static value_type combine(value_type const& a, value_type const& b) { return a + b; }
+};
+
+// How much of the keys map to each value: value -> total length, for
+// arithmetic keys and values ordered by operator<. Lengths of integral keys
+// are unsigned 64 bit, so segments from the lowest key don't overflow.
+// Summaries hold one entry per distinct value, so combining them costs
+// O(distinct values).
+template<typename K, typename V>
+struct value_histogram {
+  using length_type = std::conditional_t<std::is_integral<K>::value, std::uint64_t, double>;
+  using value_type = std::map<V, length_type>;
+
+  static value_type identity() { return {}; }
+  static value_type segment(K const& keyBegin, K const& keyEnd, V const& val) {
+    return { { val, length_type(keyEnd) - length_type(keyBegin) } };
+  }
+  static value_type combine(value_type const& a, value_type const& b) {
+    value_type result = a;
+    for (const auto& entry : b)
+      result[entry.first] += entry.second;
+    return result;
+  }
+};
+
+// interval_map that caches a monoid summary of the segments in every subtree,
+// so the aggregate of the segments in any range (clipped to it) takes
+// O(log n) monoid operations instead of visiting every segment.
+//
+// The boundaries are kept in a treap (see interval_map_treap.hpp). assign
+// splits the tree around the interval, drops the boundaries inside and joins
+// the rest with at most two new boundaries, in O(log n) plus the number of
+// boundaries dropped. As with interval_map, the first boundary is at the
+// lowest key and neighbouring boundaries never hold the same value.
+template<typename K, typename V, typename Monoid>
+class augmented_interval_map {
+public:
+  using summary_type = typename Monoid::value_type;
+
+private:
+  struct node {
+    K key;
+    V val;
+    std::uint64_t priority;
+    std::unique_ptr<node> left;
+    std::unique_ptr<node> right;
+    // Leftmost and rightmost boundaries of the subtree
+    const node* first;
+    const node* last;
+    // Summary of the segments between the subtree's first and last boundary
+    summary_type inner;
+    // Boundaries in the subtree, for order statistics
+    std::size_t size;
+
+    node(K const& k, V const& v, std::uint64_t p)
+      : key(k), val(v), priority(p), first(this), last(this), inner(Monoid::identity()), size(1) {}
+  };
+
+  using link = std::unique_ptr<node>;
+
+  link m_root;
+  interval_map_treap::priorities m_priorities;
+
+  static std::size_t sizeOf(const link& n) { return interval_map_treap::size_of(n); }
+
+  static void refresh(node& n) {
+    n.size = 1 + sizeOf(n.left) + sizeOf(n.right);
+    n.first = n.left ? n.left->first : &n;
+    n.last = n.right ? n.right->last : &n;
+    summary_type inner = Monoid::identity();
+    if (n.left) {
+      inner = Monoid::combine(n.left->inner, Monoid::segment(n.left->last->key, n.key, n.left->last->val));
+    }
+    if (n.right) {
+      inner = Monoid::combine(inner, Monoid::segment(n.key, n.right->first->key, n.val));
+      inner = Monoid::combine(inner, n.right->inner);
+    }
+    n.inner = std::move(inner);
+  }
+
+  // Nothing is pushed down; joins recompute the cached subtree data
+  struct hooks {
+    static void open(node&) {}
+    static link join(link n, link left, link right) {
+      n->left = std::move(left);
+      n->right = std::move(right);
+      refresh(*n);
+      return n;
+    }
+  };
+
+  static std::pair<link, link> split(link t, K const& key, bool keyGoesLeft) {
+    return interval_map_treap::split<hooks>(std::move(t), key, keyGoesLeft);
+  }
+
+  static link merge(link a, link b) {
+    return interval_map_treap::merge<hooks>(std::move(a), std::move(b));
+  }
+
+  static link clone(const node* n) {
+    if (!n)
+      return nullptr;
+    link copy(new node(n->key, n->val, n->priority));
+    copy->left = clone(n->left.get());
+    copy->right = clone(n->right.get());
+    refresh(*copy);
+    return copy;
+  }
+
+  // Summary of segment [keyBegin, keyEnd) clipped to [lo, hi); keyEnd is
+  // null for the last segment, which is unbounded
+  static summary_type clipped(K const& keyBegin, const K* keyEnd, V const& val, K const& lo, K const& hi) {
+    const K& begin = keyBegin < lo ? lo : keyBegin;
+    const K& end = keyEnd && *keyEnd < hi ? *keyEnd : hi;
+    return begin < end ? Monoid::segment(begin, end, val) : Monoid::identity();
+  }
+
+  // Summary of the segments of subtree n clipped to [lo, hi), where succ is
+  // the key of the boundary after the subtree (null if there is none)
+  static summary_type fold(const node* n, const K* succ, K const& lo, K const& hi) {
+    if (!n || (succ && !(lo < *succ)) || !(n->first->key < hi))
+      return Monoid::identity();
+
+    // Subtrees entirely inside the range are answered from their summary
+    if (!(n->first->key < lo) && succ && !(hi < *succ))
+      return Monoid::combine(n->inner, Monoid::segment(n->last->key, *succ, n->last->val));
+
+    const K* nodeEnd = n->right ? &n->right->first->key : succ;
+    summary_type result = fold(n->left.get(), &n->key, lo, hi);
+    result = Monoid::combine(result, clipped(n->key, nodeEnd, n->val, lo, hi));
+    return Monoid::combine(result, fold(n->right.get(), succ, lo, hi));
+  }
+
+public:
+  // constructor associates whole range of K with val by inserting (K_min, val)
+  augmented_interval_map(V const& val) {
+    m_root.reset(new node(std::numeric_limits<K>::lowest(), val, m_priorities.next()));
+  }
+
+  augmented_interval_map(const augmented_interval_map& other)
+    : m_root(clone(other.m_root.get())) {}
+
+  augmented_interval_map& operator=(const augmented_interval_map& other) {
+    if (this != &other) {
+      m_root = clone(other.m_root.get());
+    }
+    return *this;
+  }
+
+  augmented_interval_map(augmented_interval_map&&) = default;
+  augmented_interval_map& operator=(augmented_interval_map&&) = default;
+
+  // Assign value val to interval [keyBegin, keyEnd), as interval_map::assign
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    // before: keys < keyBegin, covered: keys in [keyBegin, keyEnd], after: keys > keyEnd
+    auto outer = split(std::move(m_root), keyBegin, false);
+    auto inner = split(std::move(outer.second), keyEnd, true);
+    link before = std::move(outer.first);
+    link covered = std::move(inner.first);
+
+    // Only insert boundaries that actually change the value
+    const V endVal = covered ? covered->last->val : before->last->val;
+    const bool insertBegin = !before || !(before->last->val == val);
+    const bool insertEnd = !(endVal == val);
+
+    covered.reset();
+
+    link result = std::move(before);
+    if (insertBegin)
+      result = merge(std::move(result), link(new node(keyBegin, val, m_priorities.next())));
+    if (insertEnd)
+      result = merge(std::move(result), link(new node(keyEnd, endVal, m_priorities.next())));
+    m_root = merge(std::move(result), std::move(inner.second));
+  }
+
+  // Split off the boundaries at or after key into a new map, reusing their
+  // nodes, in O(log n). This map keeps the keys below key, and both parts
+  // map the keys on the other side of key to the value just below it, so
+  // concat(*this, upper) gives back the original map.
+  augmented_interval_map split_at(K const& key) {
+    auto parts = split(std::move(m_root), key, false);
+    if (!parts.first) {
+      // key is the lowest key, so everything goes to the upper part
+      augmented_interval_map upper(parts.second->first->val);
+      upper.m_root = std::move(parts.second);
+      m_root.reset(new node(std::numeric_limits<K>::lowest(), upper.m_root->first->val, m_priorities.next()));
+      return upper;
+    }
+
+    m_root = std::move(parts.first);
+    augmented_interval_map upper(m_root->last->val);
+    upper.m_root = merge(std::move(upper.m_root), std::move(parts.second));
+    return upper;
+  }
+
+  // The map holding a's values below the first boundary of b after its
+  // lowest key, and b's from there on, joined from the nodes of both in
+  // O(log n). The value of b's lowest run is dropped. Throws
+  // std::invalid_argument if a has a boundary at or after that first
+  // boundary of b.
+  friend augmented_interval_map concat(augmented_interval_map a, augmented_interval_map b) {
+    auto rest = split(std::move(b.m_root), std::numeric_limits<K>::lowest(), true);
+    b.m_root = std::move(rest.first);
+    if (!rest.second)
+      return a;
+    if (!(a.m_root->last->key < rest.second->first->key))
+      throw std::invalid_argument("concat of augmented_interval_maps whose boundaries overlap");
+
+    // Keep the seam canonical
+    if (rest.second->first->val == a.m_root->last->val) {
+      const K seam = rest.second->first->key;
+      rest.second = split(std::move(rest.second), seam, true).second;
+    }
+    a.m_root = merge(std::move(a.m_root), std::move(rest.second));
+    return a;
+  }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const {
+    const node* found = nullptr;
+    for (const node* n = m_root.get(); n;) {
+      if (key < n->key) {
+        n = n->left.get();
+      }
+      else {
+        found = n;
+        n = n->right.get();
+      }
+    }
+    return found->val;
+  }
+
+  // Monoid summary of the segments of [lo, hi), each clipped to it, in
+  // O(log n) monoid operations. Empty ranges give the identity.
+  summary_type aggregate(K const& lo, K const& hi) const {
+    if (!(lo < hi))
+      return Monoid::identity();
+    return fold(m_root.get(), nullptr, lo, hi);
+  }
+
+  // The k-th run of a single value in key order, counting from 0, found by
+  // walking down the subtree sizes. Throws std::out_of_range if there are
+  // no more than k runs.
+  interval_run<K, V> nth_segment(std::size_t k) const {
+    if (k >= size())
+      throw std::out_of_range("augmented_interval_map::nth_segment past the last segment");
+    const node* n = nth(k);
+    return {
+      k == 0 ? std::nullopt : std::optional<K>(n->key),
+      k + 1 == size() ? std::nullopt : std::optional<K>(nth(k + 1)->key),
+      n->val
+    };
+  }
+
+  // Index of the run holding key, which is the number of boundaries before
+  // it
+  std::size_t rank(K const& key) const {
+    return countBelow(key, true) - 1;
+  }
+
+  // Number of runs overlapping [lo, hi)
+  std::size_t count_segments(K const& lo, K const& hi) const {
+    if (!(lo < hi))
+      return 0;
+    return 1 + countBelow(hi, false) - countBelow(lo, true);
+  }
+
+  // Number of boundaries, including the one at the lowest key
+  std::size_t size() const { return m_root->size; }
+
+  // Calls f(key, val) for every boundary in key order, for verifying
+  // canonical representation in tests
+  template<typename F>
+  void for_each_boundary(F&& f) const {
+    forEach(m_root.get(), f);
+  }
+
+private:
+  const node* nth(std::size_t k) const {
+    const node* n = m_root.get();
+    for (;;) {
+      const std::size_t leftSize = sizeOf(n->left);
+      if (k < leftSize) {
+        n = n->left.get();
+      }
+      else if (k == leftSize) {
+        return n;
+      }
+      else {
+        k -= leftSize + 1;
+        n = n->right.get();
+      }
+    }
+  }
+
+  // Boundaries with keys below key, or with inclusive, at or below it
+  std::size_t countBelow(K const& key, bool inclusive) const {
+    std::size_t count = 0;
+    for (const node* n = m_root.get(); n;) {
+      if (inclusive ? !(key < n->key) : n->key < key) {
+        count += sizeOf(n->left) + 1;
+        n = n->right.get();
+      }
+      else {
+        n = n->left.get();
+      }
+    }
+    return count;
+  }
+
+  template<typename F>
+  static void forEach(const node* n, F& f) {
+    if (!n)
+      return;
+    forEach(n->left.get(), f);
+    f(n->key, n->val);
+    forEach(n->right.get(), f);
+  }
+};
@@ -0,0 +1,442 @@
+#include "interval_map.hpp"
+#include "seqlock_interval_map.hpp"
+#include "mapped_interval_map.hpp"
+#include "work_stealing_pool.hpp"
+
+// Benchmarks for interval_map workloads
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <new>
+#include <random>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Count every allocation made through operator new, aligned and nothrow ones
+// included, with a header in front of each block recording its size so live
+// bytes can be tracked too
+namespace {
+  std::atomic<std::uint64_t> g_allocations{ 0 };
+  std::atomic<std::int64_t> g_liveBytes{ 0 };
+  constexpr std::size_t allocHeader = alignof(std::max_align_t);
+}
+
+void* operator new(std::size_t size) {
+  void* block = std::malloc(size + allocHeader);
+  if (!block)
+    throw std::bad_alloc();
+  std::memcpy(block, &size, sizeof(size));
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_liveBytes.fetch_add(size, std::memory_order_relaxed);
+  return static_cast<char*>(block) + allocHeader;
+}
+
+void operator delete(void* ptr) noexcept {
+  if (!ptr)
+    return;
+  void* block = static_cast<char*>(ptr) - allocHeader;
+  std::size_t size;
+  std::memcpy(&size, block, sizeof(size));
+  g_liveBytes.fetch_sub(size, std::memory_order_relaxed);
+  std::free(block);
+}
+
+void operator delete(void* ptr, std::size_t) noexcept {
+  operator delete(ptr);
+}
+
+// Over-aligned blocks, such as seqlock_interval_map's cache lines, are
+// aligned within a larger block, with the size and the start of that block
+// stored just in front
+namespace {
+  struct aligned_header {
+    void* block;
+    std::size_t size;
+  };
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+  const std::size_t alignment = static_cast<std::size_t>(align);
+  void* block = std::malloc(size + alignment + sizeof(aligned_header));
+  if (!block)
+    throw std::bad_alloc();
+  const std::uintptr_t start = reinterpret_cast<std::uintptr_t>(block) + sizeof(aligned_header);
+  char* ptr = reinterpret_cast<char*>((start + alignment - 1) / alignment * alignment);
+  const aligned_header header{ block, size };
+  std::memcpy(ptr - sizeof(header), &header, sizeof(header));
+  g_allocations.fetch_add(1, std::memory_order_relaxed);
+  g_liveBytes.fetch_add(size, std::memory_order_relaxed);
+  return ptr;
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept {
+  if (!ptr)
+    return;
+  aligned_header header;
+  std::memcpy(&header, static_cast<char*>(ptr) - sizeof(header), sizeof(header));
+  g_liveBytes.fetch_sub(header.size, std::memory_order_relaxed);
+  std::free(header.block);
+}
+
+void operator delete(void* ptr, std::size_t, std::align_val_t align) noexcept {
+  operator delete(ptr, align);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size);
+  }
+  catch (...) {
+    return nullptr;
+  }
+}
+
+void* operator new(std::size_t size, std::align_val_t align, const std::nothrow_t&) noexcept {
+  try {
+    return operator new(size, align);
+  }
+  catch (...) {
+    return nullptr;
+  }
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept {
+  operator delete(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t align, const std::nothrow_t&) noexcept {
+  operator delete(ptr, align);
+}
+
+namespace {
+
+  using clock = std::chrono::steady_clock;
+
+  struct options {
+    std::uint64_t maxSize = 1000000;
+    std::uint64_t ops = 200000;
+    std::uint64_t seed = 1;
+    bool json = false;
+  };
+
+  struct result {
+    std::string backend;
+    std::string workload;
+    std::string distribution;
+    int readPercent = 0;
+    std::uint64_t size = 0;
+    std::uint64_t ops = 0;
+    std::size_t threads = 1;
+    double nsPerOp = 0;
+    double allocsPerOp = 0;
+    double bytesPerBoundary = 0;
+  };
+
+  // Boundaries are built every keyStride keys, so a map of size n covers
+  // [0, n * keyStride)
+  constexpr int keyStride = 16;
+
+  // Zipfian ranks in [0, n) with skew theta, following Gray et al., "Quickly
+  // generating billion-record synthetic databases". zeta(n) is summed exactly
+  // for small ranks and approximated by its integral beyond that.
+  class zipfian_distribution {
+    std::uint64_t m_n;
+    double m_theta, m_alpha, m_zetan, m_eta;
+
+    static double zeta(std::uint64_t n, double theta) {
+      const std::uint64_t exact = std::min<std::uint64_t>(n, 10000);
+      double sum = 0;
+      for (std::uint64_t i = 1; i <= exact; ++i)
+        sum += std::pow(double(i), -theta);
+      if (n > exact)
+        sum += (std::pow(n + 0.5, 1 - theta) - std::pow(exact + 0.5, 1 - theta)) / (1 - theta);
+      return sum;
+    }
+
+  public:
+    zipfian_distribution(std::uint64_t n, double theta = 0.99)
+      : m_n(n), m_theta(theta), m_alpha(1 / (1 - theta)), m_zetan(zeta(n, theta)) {
+      m_eta = (1 - std::pow(2.0 / n, 1 - theta)) / (1 - zeta(2, theta) / m_zetan);
+    }
+
+    template<typename Rng>
+    std::uint64_t operator()(Rng& rng) {
+      const double u = std::uniform_real_distribution<double>(0, 1)(rng);
+      const double uz = u * m_zetan;
+      if (uz < 1)
+        return 0;
+      if (uz < 1 + std::pow(0.5, m_theta))
+        return 1;
+      return std::min<std::uint64_t>(m_n - 1, std::uint64_t(m_n * std::pow(m_eta * u - m_eta + 1, m_alpha)));
+    }
+  };
+
+  // Pregenerated keys for one distribution over a map of the given size
+  std::vector<int> makeKeys(const std::string& distribution, std::uint64_t size, std::uint64_t count, std::uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    const std::int64_t range = std::int64_t(size) * keyStride;
+    std::vector<int> keys;
+    keys.reserve(count);
+
+    if (distribution == "random") {
+      std::uniform_int_distribution<std::int64_t> dist(0, range - 1);
+      for (std::uint64_t i = 0; i < count; ++i)
+        keys.push_back(int(dist(rng)));
+    }
+    else if (distribution == "sequential") {
+      for (std::uint64_t i = 0; i < count; ++i)
+        keys.push_back(int(std::int64_t(i * 3) % range));
+    }
+    else if (distribution == "zipfian") {
+      // Scatter the hot ranks over the key space so they aren't all adjacent
+      zipfian_distribution dist(size);
+      for (std::uint64_t i = 0; i < count; ++i) {
+        const std::uint64_t rank = dist(rng);
+        const std::uint64_t boundary = (rank * 0x9E3779B97F4A7C15ull) % size;
+        keys.push_back(int(boundary * keyStride + rank % keyStride));
+      }
+    }
+    else {
+      // clustered: a few hot regions, each spanning a few hundred boundaries
+      std::uniform_int_distribution<std::int64_t> centerDist(0, range - 1);
+      std::vector<std::int64_t> centers(8);
+      for (auto& center : centers)
+        center = centerDist(rng);
+      std::uniform_int_distribution<std::size_t> clusterDist(0, centers.size() - 1);
+      std::normal_distribution<double> offsetDist(0, keyStride * 100.0);
+      for (std::uint64_t i = 0; i < count; ++i) {
+        const std::int64_t key = centers[clusterDist(rng)] + std::int64_t(offsetDist(rng));
+        keys.push_back(int(std::clamp<std::int64_t>(key, 0, range - 1)));
+      }
+    }
+
+    return keys;
+  }
+
+  std::vector<std::pair<int, int>> makeBoundaries(std::uint64_t size) {
+    std::vector<std::pair<int, int>> boundaries;
+    boundaries.reserve(size);
+    for (std::uint64_t i = 1; i < size; ++i)
+      boundaries.emplace_back(int(i * keyStride), int(i % 2));
+    return boundaries;
+  }
+
+  volatile int g_sink;
+
+  // Run ops operations against map: readPercent of them lookups, the rest
+  // assignments of a short range starting at the key
+  template<typename Map>
+  void runMix(Map& map, const std::vector<int>& keys, int readPercent, std::uint64_t seed, result& r) {
+    std::mt19937 rng(static_cast<unsigned>(seed));
+    std::vector<bool> isRead(keys.size());
+    for (std::size_t i = 0; i < keys.size(); ++i)
+      isRead[i] = int(rng() % 100) < readPercent;
+
+    int sink = 0;
+    const std::uint64_t allocsBefore = g_allocations.load();
+    const auto start = clock::now();
+    for (std::size_t i = 0; i < keys.size(); ++i) {
+      const int key = keys[i];
+      if (isRead[i]) {
+        sink += map[key];
+      }
+      else {
+        if constexpr (!std::is_same<Map, const mapped_interval_map<int, int>>::value)
+          map.assign(key, key + 1 + key % keyStride, key & 1);
+      }
+    }
+    const auto elapsed = clock::now() - start;
+    g_sink = sink;
+
+    r.ops = keys.size();
+    r.nsPerOp = std::chrono::duration<double, std::nano>(elapsed).count() / keys.size();
+    r.allocsPerOp = double(g_allocations.load() - allocsBefore) / keys.size();
+  }
+
+  void print(const result& r, const options& opts, bool& first) {
+    if (opts.json) {
+      std::printf("%s\n    {\"backend\": \"%s\", \"workload\": \"%s\", \"distribution\": \"%s\", \"read_percent\": %d, "
+        "\"size\": %llu, \"ops\": %llu, \"threads\": %zu, \"ns_per_op\": %.3f, \"allocs_per_op\": %.4f, "
+        "\"bytes_per_boundary\": %.2f}",
+        first ? "" : ",", r.backend.c_str(), r.workload.c_str(), r.distribution.c_str(), r.readPercent,
+        (unsigned long long)r.size, (unsigned long long)r.ops, r.threads, r.nsPerOp, r.allocsPerOp, r.bytesPerBoundary);
+    }
+    else {
+      std::printf("%-9s %-16s %-13s %4d%% %11llu %3zu thr %10.1f ns/op %8.3f allocs/op %8.1f B/boundary",
+        r.backend.c_str(), r.workload.c_str(), r.distribution.c_str(), r.readPercent,
+        (unsigned long long)r.size, r.threads, r.nsPerOp, r.allocsPerOp, r.bytesPerBoundary);
+      if (r.workload == "parallel_lookup")
+        std::printf(" %10.0f keys/s", 1e9 / r.nsPerOp);
+      std::printf("\n");
+    }
+    std::fflush(stdout);
+    first = false;
+  }
+
+  void usage() {
+    std::fprintf(stderr,
+      "usage: interval_map_bench [--json] [--max-size N] [--ops N] [--seed N]\n"
+      "  --json        print results as a JSON array\n"
+      "  --max-size N  largest map size in boundaries, in powers of 10 from 10 (default 1000000)\n"
+      "  --ops N       operations per workload (default 200000)\n"
+      "  --seed N      seed for the generated workloads (default 1)\n");
+  }
+
+}
+
+int main(int argc, char** argv) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--json") {
+      opts.json = true;
+    }
+    else if ((arg == "--max-size" || arg == "--ops" || arg == "--seed") && i + 1 < argc) {
+      const std::uint64_t value = std::strtoull(argv[++i], nullptr, 10);
+      (arg == "--max-size" ? opts.maxSize : arg == "--ops" ? opts.ops : opts.seed) = value;
+    }
+    else {
+      usage();
+      return 1;
+    }
+  }
+
+  const char* distributions[] = { "random", "sequential", "zipfian", "clustered" };
+  const int readPercents[] = { 100, 90, 50, 0 };
+  bool first = true;
+  if (opts.json)
+    std::printf("[");
+
+  for (std::uint64_t size = 10; size <= opts.maxSize; size *= 10) {
+    const auto boundaries = makeBoundaries(size);
+
+    // Build cost, and the memory the built map holds on to
+    result build{ "map", "build", "sorted", 0, size };
+    const std::int64_t liveBefore = g_liveBytes.load();
+    const std::uint64_t allocsBefore = g_allocations.load();
+    const auto start = clock::now();
+    auto built = std::make_unique<interval_map<int, int>>(0, boundaries.begin(), boundaries.end());
+    build.ops = size;
+    build.nsPerOp = std::chrono::duration<double, std::nano>(clock::now() - start).count() / size;
+    build.allocsPerOp = double(g_allocations.load() - allocsBefore) / size;
+    build.bytesPerBoundary = double(g_liveBytes.load() - liveBefore) / built->map().size();
+    print(build, opts, first);
+
+    for (const char* distribution : distributions) {
+      const auto keys = makeKeys(distribution, size, opts.ops, opts.seed);
+
+      for (int readPercent : readPercents) {
+        interval_map<int, int> map(*built);
+        result r{ "map", "mix", distribution, readPercent, size };
+        r.bytesPerBoundary = build.bytesPerBoundary;
+        runMix(map, keys, readPercent, opts.seed, r);
+        print(r, opts, first);
+      }
+
+      // The seqlock variant only holds small maps; leave room for writes
+      if (size <= seqlock_interval_map<int, int>::capacity() / 4) {
+        for (int readPercent : readPercents) {
+          auto map = std::make_unique<seqlock_interval_map<int, int>>(0);
+          for (const auto& boundary : boundaries)
+            map->assign(boundary.first, boundary.first + keyStride, boundary.second);
+          result r{ "seqlock", "mix", distribution, readPercent, size };
+          r.bytesPerBoundary = double(sizeof(seqlock_interval_map<int, int>)) / map->size();
+          runMix(*map, keys, readPercent, opts.seed, r);
+          print(r, opts, first);
+        }
+      }
+    }
+
+    // Read-only lookups straight from a mapped snapshot
+    // A name of its own per run, so concurrent runs don't overwrite it
+    const auto path = (std::filesystem::temp_directory_path() /
+      ("interval_map_bench_" + std::to_string(std::random_device{}()) + std::to_string(std::random_device{}()) + ".bin")).string();
+    built->save(path);
+    {
+      const auto mapped = mapped_interval_map<int, int>::open(path);
+      for (const char* distribution : distributions) {
+        const auto keys = makeKeys(distribution, size, opts.ops, opts.seed);
+        result r{ "mapped", "mix", distribution, 100, size };
+        r.bytesPerBoundary = double(std::filesystem::file_size(path)) / mapped.size();
+        runMix(mapped, keys, 100, opts.seed, r);
+        print(r, opts, first);
+      }
+    }
+    std::filesystem::remove(path);
+  }
+
+  // parallel_lookup throughput as threads are added, on the largest map
+  {
+    const std::uint64_t size = opts.maxSize;
+    const auto boundaries = makeBoundaries(size);
+    const interval_map<int, int> map(0, boundaries.begin(), boundaries.end());
+    const auto keys = makeKeys("random", size, std::max<std::uint64_t>(opts.ops, 1000000), opts.seed);
+    std::vector<int> out(keys.size());
+
+    const std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    for (std::size_t threads = 1; ; threads = std::min(threads * 2, maxThreads)) {
+      work_stealing_pool pool(threads);
+      for (bool sortChunks : { false, true }) {
+        result r{ "map", "parallel_lookup", sortChunks ? "random_sorted" : "random", 100, size };
+        r.threads = threads;
+        const std::uint64_t allocsBefore = g_allocations.load();
+        const auto start = clock::now();
+        map.parallel_lookup(keys.begin(), keys.end(), out.begin(), pool, sortChunks);
+        r.ops = keys.size();
+        r.nsPerOp = std::chrono::duration<double, std::nano>(clock::now() - start).count() / keys.size();
+        r.allocsPerOp = double(g_allocations.load() - allocsBefore) / keys.size();
+        print(r, opts, first);
+      }
+      if (threads == maxThreads)
+        break;
+    }
+  }
+
+  // Batches of short assignments on the largest map, applied sequentially and
+  // in parallel. Small batches fall back to the sequential path; large ones
+  // are split into pieces applied on the pool.
+  {
+    const std::uint64_t size = opts.maxSize;
+    const auto boundaries = makeBoundaries(size);
+    const interval_map<int, int> base(0, boundaries.begin(), boundaries.end());
+    const std::size_t maxThreads = std::max(1u, std::thread::hardware_concurrency());
+    work_stealing_pool pool(maxThreads);
+
+    for (std::uint64_t batchSize : { std::uint64_t(4096), size }) {
+      const auto keys = makeKeys("random", size, batchSize, opts.seed);
+      std::vector<interval_map<int, int>::assignment> batch;
+      batch.reserve(keys.size());
+      for (int key : keys)
+        batch.push_back({ key, key + 1 + key % keyStride, key & 1 });
+
+      for (bool parallel : { false, true }) {
+        interval_map<int, int> map(base);
+        result r{ "map", parallel ? "assign_batch_par" : "assign_batch", "random", 0, size };
+        r.threads = parallel ? maxThreads : 1;
+        const std::uint64_t allocsBefore = g_allocations.load();
+        const auto start = clock::now();
+        if (parallel)
+          map.assign_batch(batch.begin(), batch.end(), pool);
+        else
+          map.assign_batch(batch.begin(), batch.end());
+        r.ops = batch.size();
+        r.nsPerOp = std::chrono::duration<double, std::nano>(clock::now() - start).count() / batch.size();
+        r.allocsPerOp = double(g_allocations.load() - allocsBefore) / batch.size();
+        print(r, opts, first);
+      }
+    }
+  }
+
+  if (opts.json)
+    std::printf("\n]\n");
+  return 0;
+}
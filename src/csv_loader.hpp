@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cerrno>
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <utility>
+#include <vector>
+
+#include "interval_map.hpp"
+
+struct csv_load_result {
+  // Lines holding an assignment
+  std::uint64_t records = 0;
+  // Whether the whole file went through the linear bulk build
+  bool bulk = false;
+};
+
+// Apply the assignments in a text file of "begin,end,value" lines to map, in
+// file order. K and V must be arithmetic types, parsed with std::from_chars.
+// The file is read in blocks of blockSize bytes without copying lines out.
+//
+// As long as the records are sorted and don't overlap, and map hadn't been
+// assigned to before, they are collected as boundaries and built into the map
+// in one linear pass instead of being assigned one by one. The first record
+// breaking that order switches to plain assign for the rest of the file.
+//
+// Throws std::system_error if the file can't be read and std::runtime_error
+// naming the line for malformed input.
+template<typename K, typename V>
+csv_load_result load_csv(const std::string& path, interval_map<K, V>& map, std::size_t blockSize = 1 << 20) {
+  struct file_closer {
+    void operator()(std::FILE* file) const { std::fclose(file); }
+  };
+  std::unique_ptr<std::FILE, file_closer> file(std::fopen(path.c_str(), "rb"));
+  if (!file)
+    throw std::system_error(errno, std::generic_category(), "can't open " + path);
+
+  csv_load_result result;
+  std::uint64_t line = 0;
+  const V defaultVal = map[std::numeric_limits<K>::lowest()];
+  bool bulk = map.map().size() == 1;
+  std::vector<std::pair<K, V>> boundaries;
+
+  auto fail = [&](const char* what) {
+    throw std::runtime_error(path + ":" + std::to_string(line) + ": " + what);
+  };
+
+  // Leave the linear path, building what has been collected so far
+  auto finishBulk = [&]() {
+    map = interval_map<K, V>(defaultVal, boundaries.begin(), boundaries.end());
+    boundaries = std::vector<std::pair<K, V>>();
+    bulk = false;
+  };
+
+  auto parseLine = [&](const char* first, const char* last) {
+    ++line;
+    if (first != last && last[-1] == '\r')
+      --last;
+    if (first == last)
+      return;
+
+    K keyBegin{}, keyEnd{};
+    V val{};
+    auto parsed = std::from_chars(first, last, keyBegin);
+    if (parsed.ec != std::errc() || parsed.ptr == last || *parsed.ptr != ',')
+      fail("expected begin,end,value");
+    parsed = std::from_chars(parsed.ptr + 1, last, keyEnd);
+    if (parsed.ec != std::errc() || parsed.ptr == last || *parsed.ptr != ',')
+      fail("expected begin,end,value");
+    parsed = std::from_chars(parsed.ptr + 1, last, val);
+    if (parsed.ec != std::errc() || parsed.ptr != last)
+      fail("expected begin,end,value");
+
+    ++result.records;
+    if (!(keyBegin < keyEnd))
+      return;
+
+    // Sorted and non-overlapping means starting at or after the last end
+    if (bulk && !boundaries.empty() && keyBegin < boundaries.back().first)
+      finishBulk();
+
+    if (!bulk) {
+      map.assign(keyBegin, keyEnd, val);
+      return;
+    }
+
+    if (!boundaries.empty() && !(boundaries.back().first < keyBegin))
+      boundaries.back().second = val;
+    else
+      boundaries.emplace_back(keyBegin, val);
+    boundaries.emplace_back(keyEnd, defaultVal);
+  };
+
+  std::vector<char> buffer(blockSize > 0 ? blockSize : 1);
+  std::size_t carried = 0;
+  for (;;) {
+    const std::size_t read = std::fread(buffer.data() + carried, 1, buffer.size() - carried, file.get());
+    if (read == 0 && std::ferror(file.get()))
+      fail("read error");
+
+    const char* first = buffer.data();
+    const char* last = buffer.data() + carried + read;
+    for (;;) {
+      const char* newline = static_cast<const char*>(std::memchr(first, '\n', last - first));
+      if (!newline)
+        break;
+      parseLine(first, newline);
+      first = newline + 1;
+    }
+
+    if (read == 0) {
+      // Final line without a newline
+      if (first != last)
+        parseLine(first, last);
+      break;
+    }
+
+    // Carry the partial line to the front of the buffer, growing it if a
+    // single line fills the whole block
+    carried = last - first;
+    std::memmove(buffer.data(), first, carried);
+    if (carried == buffer.size())
+      buffer.resize(buffer.size() * 2);
+  }
+
+  result.bulk = bulk;
+  if (bulk)
+    finishBulk();
+  return result;
+}
@@ -1,69 +1,28 @@
-#include <map>
-#include <limits>
-
-template<typename K, typename V>
-class interval_map {
-  std::map<K, V> m_map;
-
-public:
-  // constructor associates whole range of K with val by inserting (K_min, val)
-  // into the map
-  interval_map(V const& val) {
-    m_map.insert(m_map.end(), std::make_pair(std::numeric_limits<K>::lowest(), val));
-  }
-
-  // Assign value val to interval [keyBegin, keyEnd).
-  // Overwrite previous values in this interval.
-  // Conforming to the C++ Standard Library conventions, the interval
-  // includes keyBegin, but excludes keyEnd.
-  // If !( keyBegin < keyEnd ), this designates an empty interval,
-  // and assign must do nothing.
-  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
-
-    // If !(keyBegin < keyEnd), assign should do nothing
-    if (!(keyBegin < keyEnd))
-      return;
-
-    // Store the end value to reinsert it at the end of the range
-    const V endVal = (*this)[keyEnd];
-
-    // Erase values in the range
-    auto beginIt = m_map.lower_bound(keyBegin);
-    auto endIt = m_map.lower_bound(keyEnd);
-
-    // If the value at keyBegin isn't already the right value, insert it
-    if (beginIt == m_map.end() || m_map.key_comp()(keyBegin, beginIt->first)) {
-      beginIt = m_map.insert(beginIt, std::make_pair(keyBegin, val));
-    }
-    else {
-      beginIt->second = val;
-    }
-
-    // If the value at keyEnd isn't already the right value, insert it
-    if (endIt == m_map.end() || m_map.key_comp()(keyEnd, endIt->first)) {
-      endIt = m_map.insert(endIt, std::make_pair(keyEnd, endVal));
-    }
-    else {
-      endIt->second = endVal;
-    }
-
-    if (++beginIt != endIt)
-      m_map.erase(beginIt, endIt);
-  }
-
-  // look-up of the value associated with key
-  V const& operator[](K const& key) const {
-    return (--m_map.upper_bound(key))->second;
-  }
-
-  // little backdoor for verifying canonical representation in tests
-  const std::map<K, V>& map() const { return m_map; }
-};
+#include "interval_map.hpp"
+#include "seqlock_interval_map.hpp"
+#include "mapped_interval_map.hpp"
+#include "logged_interval_map.hpp"
+#include "csv_loader.hpp"
+#include "interval_map_trace.hpp"
+#include "lossy_interval_map.hpp"
+#include "sparse_interval_map.hpp"
+#include "interval_map_overlay.hpp"
+#include "numeric_interval_map.hpp"
+#include "augmented_interval_map.hpp"
+#include "indexed_interval_map.hpp"
+#include "shifting_interval_map.hpp"
+#include "persistent_interval_map.hpp"
 
 // Unit tests
 #include <catch.hpp>
 #include <random>
 #include <optional>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <filesystem>
+#include <fstream>
+#include <tuple>
 
 #define TEST_MACRO REQUIRE
 #define TEST_MACRO_FALSE REQUIRE_FALSE
@@ -108,6 +67,30 @@ std::ostream& operator << (std::ostream& os, Val const& value) {
   return os;
 }
 
+// Directory of its own under the temp directory for a test's files, so
+// concurrent test runs don't clobber each other's. Removed with everything in
+// it when the test is done.
+class scratch_dir {
+  std::filesystem::path m_path;
+
+public:
+  explicit scratch_dir(const std::string& name) {
+    std::random_device rd;
+    do {
+      m_path = std::filesystem::temp_directory_path() / (name + "_" + std::to_string(rd()) + std::to_string(rd()));
+    } while (!std::filesystem::create_directory(m_path));
+  }
+  ~scratch_dir() {
+    std::error_code ec;
+    std::filesystem::remove_all(m_path, ec);
+  }
+  scratch_dir(const scratch_dir&) = delete;
+  scratch_dir& operator=(const scratch_dir&) = delete;
+
+  const std::filesystem::path& path() const { return m_path; }
+  std::string file(const std::string& name) const { return (m_path / name).string(); }
+};
+
 auto checkCanonicity = [](const interval_map<Key,Val>& m) {
   INFO("check map canonicity");
   const auto& internalMap = m.map();
@@ -844,4 +827,1666 @@ TEST_CASE("interval_map") {
       }
     }
   }
-}
\ No newline at end of file
+}
+
+TEST_CASE("seqlock_interval_map") {
+  SECTION("matches interval_map for random assignments") {
+    seqlock_interval_map<int, char> m('a');
+    interval_map<int, char> reference('a');
+
+    std::mt19937 mt(1234);
+    std::uniform_int_distribution<int> keyDist(-50, 50);
+    std::uniform_int_distribution<int> valDist('a', 'e');
+    for (int i = 0; i < 200; ++i) {
+      int keyBegin = keyDist(mt);
+      int keyEnd = keyDist(mt);
+      char val = char(valDist(mt));
+      m.assign(keyBegin, keyEnd, val);
+      reference.assign(keyBegin, keyEnd, val);
+
+      for (int key = -60; key <= 60; ++key) {
+        INFO(std::string("Testing for key ") + std::to_string(key));
+        TEST_MACRO(m[key] == reference[key]);
+      }
+      TEST_MACRO(m[std::numeric_limits<int>::lowest()] == reference[std::numeric_limits<int>::lowest()]);
+      TEST_MACRO(m[std::numeric_limits<int>::max()] == reference[std::numeric_limits<int>::max()]);
+
+      // Check this is the minimal representation
+      const auto boundaries = m.boundaries();
+      TEST_MACRO(boundaries.front().first == std::numeric_limits<int>::lowest());
+      for (size_t j = 1; j < boundaries.size(); ++j)
+        TEST_MACRO_FALSE(boundaries[j - 1].second == boundaries[j].second);
+    }
+  }
+
+  SECTION("capacity is enforced without modifying the map") {
+    seqlock_interval_map<int, char, 4> m('a');
+    m.assign(10, 20, 'b');
+    TEST_MACRO(m.size() == 3);
+    TEST_MACRO_FALSE(m.size() == m.capacity());
+
+    REQUIRE_THROWS_AS(m.assign(30, 40, 'c'), std::length_error);
+    TEST_MACRO(m.size() == 3);
+    TEST_MACRO(m[9] == 'a');
+    TEST_MACRO(m[10] == 'b');
+    TEST_MACRO(m[20] == 'a');
+    TEST_MACRO(m[35] == 'a');
+
+    // Extending an existing interval needs no extra boundaries
+    m.assign(15, 40, 'b');
+    TEST_MACRO(m.size() == 3);
+    TEST_MACRO(m[39] == 'b');
+    TEST_MACRO(m[40] == 'a');
+  }
+
+  SECTION("readers see either the old or the new value while a writer runs") {
+    seqlock_interval_map<int, char> m('a');
+    std::atomic<bool> done{ false };
+    std::atomic<int> badReads{ 0 };
+
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+      readers.emplace_back([&]() {
+        while (!done.load()) {
+          const char inside = m[15];
+          if (!(inside == 'a' || inside == 'x'))
+            ++badReads;
+          if (!(m[5] == 'a') || !(m[25] == 'a'))
+            ++badReads;
+        }
+      });
+    }
+
+    for (int i = 0; i < 20000; ++i) {
+      m.assign(10, 20, 'x');
+      m.assign(0, 30, 'a');
+    }
+    done = true;
+    for (auto& reader : readers)
+      reader.join();
+
+    TEST_MACRO(badReads.load() == 0);
+    TEST_MACRO(m.size() == 1);
+  }
+
+  SECTION("readers get consistent snapshots while a writer moves boundaries") {
+    // Stripes from 100 on stay put, while the writer toggles one at the
+    // front, moving every boundary after it back and forth
+    seqlock_interval_map<int, int, 256> m(0);
+    for (int stripe = 0; stripe < 100; ++stripe)
+      m.assign(100 + stripe * 10, 105 + stripe * 10, stripe + 1);
+
+    std::atomic<bool> done{ false };
+    std::atomic<int> badReads{ 0 };
+    std::vector<std::thread> readers;
+    for (int i = 0; i < 4; ++i) {
+      readers.emplace_back([&]() {
+        while (!done.load()) {
+          const auto boundaries = m.boundaries();
+          const std::size_t front = boundaries.size() == 201 ? 1 : 3;
+          if (!(boundaries.size() == 201 || boundaries.size() == 203)) {
+            ++badReads;
+            continue;
+          }
+          for (int stripe = 0; stripe < 100; ++stripe) {
+            const auto& begin = boundaries[front + 2 * stripe];
+            const auto& end = boundaries[front + 2 * stripe + 1];
+            if (!(begin.first == 100 + stripe * 10 && begin.second == stripe + 1 && end.first == 105 + stripe * 10 && end.second == 0))
+              ++badReads;
+          }
+          if (!(m[150] == 6) || !(m[155] == 0))
+            ++badReads;
+        }
+      });
+    }
+
+    for (int i = 0; i < 20000; ++i) {
+      m.assign(10, 20, -1);
+      m.assign(10, 20, 0);
+    }
+    done = true;
+    for (auto& reader : readers)
+      reader.join();
+
+    TEST_MACRO(badReads.load() == 0);
+    TEST_MACRO(m.size() == 201);
+  }
+}
+
+TEST_CASE("interval_map parallel construction") {
+  work_stealing_pool pool(4);
+
+  std::mt19937 mt(42);
+  std::uniform_int_distribution<int> valDist('a', 'c');
+
+  // Sorted boundaries with plenty of repeated values to be canonicalised away
+  std::vector<std::pair<Key, Val>> boundaries;
+  for (int i = 0; i < 20000; ++i)
+    boundaries.emplace_back(Key(i * 3 - 30000), Val(char(valDist(mt))));
+
+  SECTION("sequential and parallel builds agree") {
+    interval_map<Key, Val> sequential(Val('a'), boundaries.begin(), boundaries.end());
+    interval_map<Key, Val> parallel(Val('a'), boundaries.begin(), boundaries.end(), pool);
+
+    checkCanonicity(sequential);
+    checkCanonicity(parallel);
+    TEST_MACRO(sequential.map().size() == parallel.map().size());
+    for (const auto& boundary : boundaries) {
+      TEST_MACRO(sequential[boundary.first] == boundary.second);
+      TEST_MACRO(parallel[boundary.first] == boundary.second);
+      TEST_MACRO(parallel[Key(boundary.first.val() + 1)] == boundary.second);
+    }
+    TEST_MACRO(parallel[Key(-30001)] == Val('a'));
+  }
+
+  SECTION("a boundary at the lowest key replaces the initial value") {
+    std::vector<std::pair<Key, Val>> lowest{ { std::numeric_limits<Key>::lowest(), Val('z') }, { Key(0), Val('a') } };
+    interval_map<Key, Val> m(Val('a'), lowest.begin(), lowest.end(), pool);
+
+    checkSize(m, 2);
+    TEST_MACRO(m[std::numeric_limits<Key>::lowest()] == Val('z'));
+    TEST_MACRO(m[Key(-1)] == Val('z'));
+    TEST_MACRO(m[Key(0)] == Val('a'));
+  }
+
+  SECTION("parallel batch assign matches sequential assign") {
+    interval_map<Key, Val> sequential(Val('a'), boundaries.begin(), boundaries.end());
+    interval_map<Key, Val> parallel(Val('a'), boundaries.begin(), boundaries.end());
+
+    std::uniform_int_distribution<int> keyDist(-40000, 40000);
+    std::uniform_int_distribution<int> lengthDist(0, 500);
+    std::vector<interval_map<Key, Val>::assignment> batch;
+    for (int i = 0; i < 10000; ++i) {
+      Key keyBegin(keyDist(mt));
+      batch.push_back({ keyBegin, Key(keyBegin.val() + lengthDist(mt)), Val(char(valDist(mt))) });
+    }
+    batch.push_back({ std::numeric_limits<Key>::lowest(), Key(-35000), Val('d') });
+
+    sequential.assign_batch(batch.begin(), batch.end());
+    parallel.assign_batch(batch.begin(), batch.end(), pool);
+
+    checkCanonicity(parallel);
+    TEST_MACRO(sequential.map().size() == parallel.map().size());
+    for (int key = -41000; key <= 41000; ++key)
+      TEST_MACRO(sequential[Key(key)] == parallel[Key(key)]);
+  }
+
+  SECTION("parallel batch assign keeps seams between pieces canonical") {
+    // Abutting assignments of few values, so pieces meet at boundaries that
+    // must merge with their neighbours; and a batch small enough to take the
+    // sequential path
+    for (int batchSize : { 20000, 100 }) {
+      interval_map<Key, Val> sequential(Val('a'), boundaries.begin(), boundaries.end());
+      interval_map<Key, Val> parallel(Val('a'), boundaries.begin(), boundaries.end());
+
+      std::uniform_int_distribution<int> keyDist(-3000, 3000);
+      std::uniform_int_distribution<int> lengthDist(1, 8);
+      std::vector<interval_map<Key, Val>::assignment> batch;
+      for (int i = 0; i < batchSize; ++i) {
+        const int keyBegin = keyDist(mt) * 10;
+        batch.push_back({ Key(keyBegin), Key(keyBegin + lengthDist(mt) * 10), Val(char(valDist(mt))) });
+      }
+
+      sequential.assign_batch(batch.begin(), batch.end());
+      parallel.assign_batch(batch.begin(), batch.end(), pool);
+
+      checkCanonicity(parallel);
+      TEST_MACRO(sequential.map().size() == parallel.map().size());
+      for (int key = -31000; key <= 31000; ++key)
+        TEST_MACRO(sequential[Key(key)] == parallel[Key(key)]);
+    }
+  }
+
+  SECTION("exceptions propagate out of parallel_for") {
+    REQUIRE_THROWS_AS(pool.parallel_for(16, [](std::size_t i) {
+      if (i == 7)
+        throw std::runtime_error("task failed");
+    }), std::runtime_error);
+  }
+
+  SECTION("nested parallel_for runs every task once") {
+    std::vector<std::atomic<int>> runs(64 * 64);
+    for (int round = 0; round < 20; ++round) {
+      pool.parallel_for(64, [&](std::size_t i) {
+        pool.parallel_for(64, [&](std::size_t j) { runs[i * 64 + j].fetch_add(1); });
+      });
+    }
+    for (const auto& count : runs)
+      TEST_MACRO(count.load() == 20);
+  }
+}
+
+TEST_CASE("interval_map parallel_lookup") {
+  work_stealing_pool pool(4);
+
+  interval_map<Key, Val> m(Val('a'));
+  std::mt19937 mt(7);
+  std::uniform_int_distribution<int> keyDist(-100000, 100000);
+  std::uniform_int_distribution<int> valDist('a', 'z');
+  for (int i = 0; i < 2000; ++i) {
+    Key keyBegin(keyDist(mt));
+    m.assign(keyBegin, Key(keyBegin.val() + 50), Val(char(valDist(mt))));
+  }
+
+  std::vector<Key> keys;
+  for (int i = 0; i < 50000; ++i)
+    keys.push_back(Key(keyDist(mt)));
+  keys.push_back(std::numeric_limits<Key>::lowest());
+  keys.push_back(std::numeric_limits<Key>::max());
+
+  for (bool sortChunks : { false, true }) {
+    INFO(std::string("sortChunks ") + (sortChunks ? "true" : "false"));
+    std::vector<Val> out(keys.size(), Val('?'));
+    m.parallel_lookup(keys.begin(), keys.end(), out.begin(), pool, sortChunks);
+    for (size_t i = 0; i < keys.size(); ++i)
+      TEST_MACRO(out[i] == m[keys[i]]);
+  }
+}
+
+TEST_CASE("mapped_interval_map") {
+  const scratch_dir scratch("mapped_interval_map_test");
+  const std::string path = scratch.file("map.bin");
+
+  interval_map<int, char> m('a');
+  std::mt19937 mt(99);
+  std::uniform_int_distribution<int> keyDist(-10000, 10000);
+  std::uniform_int_distribution<int> valDist('a', 'z');
+  for (int i = 0; i < 500; ++i) {
+    int keyBegin = keyDist(mt);
+    m.assign(keyBegin, keyBegin + 20, char(valDist(mt)));
+  }
+  m.save(path);
+
+  SECTION("lookups match the saved map") {
+    auto mapped = mapped_interval_map<int, char>::open(path);
+    TEST_MACRO(mapped.size() == m.map().size());
+    TEST_MACRO(mapped.verify());
+    for (int key = -10100; key <= 10100; ++key)
+      TEST_MACRO(mapped[key] == m[key]);
+    TEST_MACRO(mapped[std::numeric_limits<int>::lowest()] == m[std::numeric_limits<int>::lowest()]);
+    TEST_MACRO(mapped[std::numeric_limits<int>::max()] == m[std::numeric_limits<int>::max()]);
+
+    // Saving over a mapped file replaces it without disturbing the mapping
+    interval_map<int, char>('q').save(path);
+    TEST_MACRO(mapped.verify());
+    TEST_MACRO(mapped_interval_map<int, char>::open(path)[0] == 'q');
+  }
+
+  SECTION("concurrent saves to one path each leave a whole file") {
+    std::vector<interval_map<int, char>> maps;
+    for (int i = 0; i < 4; ++i) {
+      maps.push_back(m);
+      maps.back().assign(-100, 100, char('A' + i));
+    }
+    std::vector<std::thread> savers;
+    for (const auto& map : maps)
+      savers.emplace_back([&] {
+        for (int round = 0; round < 20; ++round)
+          map.save(path);
+      });
+    for (auto& saver : savers)
+      saver.join();
+
+    auto mapped = mapped_interval_map<int, char>::open(path);
+    TEST_MACRO(mapped.verify());
+    const char saved = mapped[0];
+    TEST_MACRO(saved >= 'A');
+    TEST_MACRO(saved <= 'D');
+    for (int key = -10100; key <= 10100; key += 7)
+      TEST_MACRO(mapped[key] == maps[saved - 'A'][key]);
+    // No temporary files are left behind
+    TEST_MACRO(std::distance(std::filesystem::directory_iterator(scratch.path()), std::filesystem::directory_iterator()) == 1);
+  }
+
+  SECTION("corrupt payloads fail verification") {
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(-1, std::ios::end);
+      file.put('!');
+    }
+    auto mapped = mapped_interval_map<int, char>::open(path);
+    TEST_MACRO_FALSE(mapped.verify());
+  }
+
+  SECTION("mismatched or damaged headers are rejected") {
+    REQUIRE_THROWS_AS((mapped_interval_map<int, int>::open(path)), std::runtime_error);
+    {
+      std::fstream file(path, std::ios::binary | std::ios::in | std::ios::out);
+      file.seekp(12);
+      file.put('\x7f');
+    }
+    REQUIRE_THROWS_AS((mapped_interval_map<int, char>::open(path)), std::runtime_error);
+    REQUIRE_THROWS_AS((mapped_interval_map<int, char>::open(path + ".missing")), std::system_error);
+  }
+
+}
+
+TEST_CASE("logged_interval_map") {
+  const scratch_dir scratch("logged_interval_map_test");
+  const auto& dir = scratch.path();
+
+  auto countFiles = [&](const std::string& prefix) {
+    int count = 0;
+    for (const auto& entry : std::filesystem::directory_iterator(dir))
+      count += entry.path().filename().string().compare(0, prefix.size(), prefix) == 0;
+    return count;
+  };
+
+  interval_map<int, char> reference('a');
+  std::mt19937 mt(5);
+  std::uniform_int_distribution<int> keyDist(-1000, 1000);
+  std::uniform_int_distribution<int> valDist('a', 'z');
+  auto assignRandom = [&](logged_interval_map<int, char>& m, int count) {
+    for (int i = 0; i < count; ++i) {
+      int keyBegin = keyDist(mt);
+      int keyEnd = keyBegin + keyDist(mt) / 10;
+      char val = char(valDist(mt));
+      m.assign(keyBegin, keyEnd, val);
+      reference.assign(keyBegin, keyEnd, val);
+    }
+  };
+  auto checkMatches = [&](const logged_interval_map<int, char>& m) {
+    TEST_MACRO(m.map().map() == reference.map());
+  };
+
+  wal_options options;
+  options.groupCommitRecords = 16;
+  options.compactAfterBytes = 0;
+
+  SECTION("recovery replays the log") {
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      assignRandom(m, 300);
+      m.commit();
+      checkMatches(m);
+    }
+
+    logged_interval_map<int, char> m(dir.string(), 'a', options);
+    checkMatches(m);
+    TEST_MACRO(countFiles("snapshot-") == 0);
+  }
+
+  SECTION("files that aren't the log's own are left alone") {
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      assignRandom(m, 100);
+    }
+    for (const char* name : { "wal-old.bak", "wal-", "wal-007", "snapshot-x", "snapshot-1-copy", "notes.txt" })
+      std::ofstream(dir / name) << "not a log";
+    std::ofstream(dir / "snapshot-9.tmp.1.0") << "unfinished";
+
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      checkMatches(m);
+      assignRandom(m, 100);
+      m.compact();
+    }
+
+    logged_interval_map<int, char> m(dir.string(), 'a', options);
+    checkMatches(m);
+    TEST_MACRO(std::filesystem::exists(dir / "wal-old.bak"));
+    TEST_MACRO(std::filesystem::exists(dir / "wal-007"));
+    TEST_MACRO(std::filesystem::exists(dir / "snapshot-x"));
+    TEST_MACRO(std::filesystem::exists(dir / "notes.txt"));
+    TEST_MACRO_FALSE(std::filesystem::exists(dir / "snapshot-9.tmp.1.0"));
+  }
+
+  SECTION("a torn final record is dropped") {
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      assignRandom(m, 100);
+    }
+    for (const auto& entry : std::filesystem::directory_iterator(dir)) {
+      std::ofstream log(entry.path(), std::ios::binary | std::ios::app);
+      log.write("\x12\x34\x56", 3);
+    }
+
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      checkMatches(m);
+      assignRandom(m, 100);
+    }
+
+    logged_interval_map<int, char> m(dir.string(), 'a', options);
+    checkMatches(m);
+  }
+
+  SECTION("compaction folds the log into a snapshot") {
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      assignRandom(m, 200);
+      m.compact();
+      TEST_MACRO(countFiles("snapshot-") == 1);
+      TEST_MACRO(countFiles("wal-") == 1);
+      assignRandom(m, 200);
+    }
+
+    logged_interval_map<int, char> m(dir.string(), 'a', options);
+    checkMatches(m);
+  }
+
+  SECTION("background compaction runs once the log grows") {
+    options.compactAfterBytes = 1024;
+    {
+      logged_interval_map<int, char> m(dir.string(), 'a', options);
+      assignRandom(m, 1000);
+      for (int i = 0; i < 500 && countFiles("snapshot-") == 0; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+      TEST_MACRO(countFiles("snapshot-") >= 1);
+      m.commit();
+    }
+
+    logged_interval_map<int, char> m(dir.string(), 'a', options);
+    checkMatches(m);
+  }
+
+}
+
+TEST_CASE("load_csv") {
+  const scratch_dir scratch("load_csv_test");
+  const std::string path = scratch.file("map.csv");
+  auto writeFile = [&](const std::string& contents) {
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file << contents;
+  };
+
+  std::mt19937 mt(3);
+  std::uniform_int_distribution<int> gapDist(0, 3);
+  std::uniform_int_distribution<int> lengthDist(1, 20);
+  std::uniform_int_distribution<int> valDist(0, 3);
+
+  // Sorted, non-overlapping records, some adjacent, some repeating values
+  std::string sorted;
+  interval_map<int, int> reference(0);
+  int key = -5000;
+  for (int i = 0; i < 2000; ++i) {
+    int keyBegin = key + gapDist(mt);
+    int keyEnd = keyBegin + lengthDist(mt);
+    int val = valDist(mt);
+    sorted += std::to_string(keyBegin) + "," + std::to_string(keyEnd) + "," + std::to_string(val) + (i % 2 ? "\r\n" : "\n");
+    reference.assign(keyBegin, keyEnd, val);
+    key = keyEnd;
+  }
+
+  SECTION("sorted input takes the bulk path") {
+    for (std::size_t blockSize : { std::size_t(7), std::size_t(1) << 20 }) {
+      writeFile(sorted);
+      interval_map<int, int> m(0);
+      const auto result = load_csv(path, m, blockSize);
+      TEST_MACRO(result.records == 2000);
+      TEST_MACRO(result.bulk);
+      TEST_MACRO(m.map() == reference.map());
+    }
+  }
+
+  SECTION("unsorted input falls back to assign") {
+    writeFile(sorted + "-4990,-4980,9\n100,90,7\n-10000,-4000,2");
+    reference.assign(-4990, -4980, 9);
+    reference.assign(-10000, -4000, 2);
+
+    interval_map<int, int> m(0);
+    const auto result = load_csv(path, m, 64);
+    TEST_MACRO(result.records == 2003);
+    TEST_MACRO_FALSE(result.bulk);
+    TEST_MACRO(m.map() == reference.map());
+  }
+
+  SECTION("a map that was already assigned to is assigned in order") {
+    writeFile("0,10,1\n20,30,2\n");
+    interval_map<int, int> m(0);
+    m.assign(5, 25, 3);
+    const auto result = load_csv(path, m);
+    TEST_MACRO_FALSE(result.bulk);
+    TEST_MACRO(m[5] == 1);
+    TEST_MACRO(m[15] == 3);
+    TEST_MACRO(m[25] == 2);
+  }
+
+  SECTION("malformed lines report their line number") {
+    writeFile("0,10,1\n\n20,x,2\n");
+    interval_map<int, int> m(0);
+    try {
+      load_csv(path, m);
+      FAIL("expected load_csv to throw");
+    }
+    catch (const std::runtime_error& error) {
+      TEST_MACRO(std::string(error.what()).find(":3:") != std::string::npos);
+    }
+  }
+
+}
+
+TEST_CASE("interval_map trace") {
+  const scratch_dir scratch("interval_map_trace_test");
+  const std::string path = scratch.file("map.trace");
+
+  std::mt19937 mt(11);
+  std::uniform_int_distribution<int> keyDist(-1000, 1000);
+  std::uniform_int_distribution<int> valDist(0, 5);
+
+  for (bool anonymize : { false, true }) {
+    INFO(std::string("anonymize ") + (anonymize ? "true" : "false"));
+    std::vector<int> looked;
+    {
+      recording_interval_map<int, int> m(path, 7, anonymize);
+      for (int i = 0; i < 1000; ++i) {
+        int key = keyDist(mt);
+        if (i % 3 == 0)
+          m.assign(key, key + valDist(mt) * 10, valDist(mt));
+        else
+          looked.push_back(m[key]);
+      }
+    }
+
+    interval_map_trace::reader<int, int> in(path);
+    TEST_MACRO(in.initial_value() == 7);
+    TEST_MACRO(in.header().anonymized == (anonymize ? 1u : 0u));
+    const auto records = interval_map_trace::read_all(in);
+    TEST_MACRO(records.size() == 1000);
+
+    // Replaying gives the same lookups on every backend, anonymized or not
+    interval_map<int, int> map(in.initial_value());
+    seqlock_interval_map<int, int> seqlock(in.initial_value());
+    const auto mapStats = interval_map_trace::replay(map, records);
+    const auto seqlockStats = interval_map_trace::replay(seqlock, records);
+    TEST_MACRO(mapStats.assigns == 334);
+    TEST_MACRO(mapStats.lookups == 666);
+    TEST_MACRO(mapStats.lookupChecksum == seqlockStats.lookupChecksum);
+
+    interval_map_trace::replay_stats expected;
+    for (int val : looked)
+      expected.lookupChecksum = interval_map_file::checksum(&val, sizeof(val), expected.lookupChecksum);
+    TEST_MACRO(mapStats.lookupChecksum == expected.lookupChecksum);
+  }
+
+  // A workload at the top of the key range, with max() as an end sentinel,
+  // replays the same when anonymized, as its keys are close to the first one
+  for (int top : { std::numeric_limits<int>::max(), std::numeric_limits<int>::max() - 3 }) {
+    std::vector<int> looked;
+    {
+      recording_interval_map<int, int> m(path, 0, true);
+      m.assign(top - 100, top, 1);
+      m.assign(top - 10, top, 2);
+      m.assign(top - 50, top - 20, 3);
+      for (int key : { top - 101, top - 100, top - 51, top - 50, top - 11, top - 10, top - 1, top })
+        looked.push_back(m[key]);
+      m.close();
+    }
+
+    interval_map_trace::reader<int, int> in(path);
+    const auto records = interval_map_trace::read_all(in);
+    TEST_MACRO(records.size() == 11);
+    for (const auto& r : records) {
+      if (r.op == interval_map_trace::op_assign)
+        TEST_MACRO(r.keyBegin < r.keyEnd);
+    }
+
+    interval_map<int, int> map(in.initial_value());
+    const auto stats = interval_map_trace::replay(map, records);
+    interval_map_trace::replay_stats expected;
+    for (int val : looked)
+      expected.lookupChecksum = interval_map_file::checksum(&val, sizeof(val), expected.lookupChecksum);
+    TEST_MACRO(stats.lookupChecksum == expected.lookupChecksum);
+    TEST_MACRO(map.map().size() == 6);
+  }
+
+  // Keys far from the first one are clamped to the ends of the key range
+  // rather than wrapping around, keeping their order. Records are written as
+  // they come, not held until close.
+  {
+    interval_map_trace::writer<int, int> out(path, 0, true);
+    out.record_assign(0, 10, 1);
+    out.record_lookup(std::numeric_limits<int>::lowest());
+    out.record_lookup(std::numeric_limits<int>::max());
+    out.record_lookup(-5);
+    // The offset moves keys one way, so only one end is passed
+    TEST_MACRO(out.clamped() == 1);
+    out.flush();
+
+    interval_map_trace::reader<int, int> in(path);
+    const auto records = interval_map_trace::read_all(in);
+    TEST_MACRO(records.size() == 4);
+    TEST_MACRO(records[0].keyEnd - records[0].keyBegin == 10);
+    TEST_MACRO(records[0].keyBegin - records[3].keyBegin == 5);
+    TEST_MACRO(records[1].keyBegin < records[3].keyBegin);
+    TEST_MACRO(records[0].keyEnd < records[2].keyBegin);
+    TEST_MACRO((records[1].keyBegin == std::numeric_limits<int>::lowest() || records[2].keyBegin == std::numeric_limits<int>::max()));
+  }
+
+  REQUIRE_THROWS_AS((interval_map_trace::reader<int, char>(path)), std::runtime_error);
+}
+
+// The stats tests build with INTERVAL_MAP_STATS in exercise_stats.cpp; here
+// it's off, as by default, and interval_map carries nothing for it
+template<typename Map, typename = void>
+struct has_stats : std::false_type {};
+template<typename Map>
+struct has_stats<Map, std::void_t<decltype(std::declval<const Map&>().stats())>> : std::true_type {};
+
+TEST_CASE("interval_map stats compiled out") {
+#ifndef INTERVAL_MAP_STATS
+  TEST_MACRO_FALSE(has_stats<interval_map<int, char>>::value);
+  TEST_MACRO(sizeof(interval_map<int, std::size_t>) == sizeof(std::map<int, std::size_t>) + sizeof(std::size_t));
+#endif
+}
+
+TEST_CASE("interval_map memory_usage") {
+  interval_map<int, std::int64_t> m(0);
+  const auto empty = m.memory_usage();
+  TEST_MACRO(empty.values == sizeof(std::pair<const int, std::int64_t>));
+  TEST_MACRO(empty.nodes > 0);
+  TEST_MACRO(empty.total() == empty.nodes + empty.values + empty.overhead + empty.slack);
+  TEST_MACRO(empty.total() % 16 == 0);
+
+  for (int i = 0; i < 100; ++i)
+    m.assign(i * 10, i * 10 + 5, i + 1);
+  const auto full = m.memory_usage();
+  TEST_MACRO(m.map().size() == 201);
+  TEST_MACRO(full.total() == empty.total() * 201);
+  TEST_MACRO(full.slack == 0);
+
+  seqlock_interval_map<int, std::int64_t, 64> s(0);
+  s.assign(10, 20, 1);
+  const auto flat = s.memory_usage();
+  TEST_MACRO(flat.values == 3 * (sizeof(int) + sizeof(std::int64_t)));
+  TEST_MACRO(flat.slack == 61 * (sizeof(int) + sizeof(std::int64_t)));
+  TEST_MACRO(flat.total() == sizeof(s));
+
+  const scratch_dir scratch("interval_map_memory_test");
+  const std::string path = scratch.file("map.bin");
+  m.save(path);
+  {
+    auto mapped = mapped_interval_map<int, std::int64_t>::open(path);
+    const auto usage = mapped.memory_usage();
+    TEST_MACRO(usage.values == 201 * (sizeof(int) + sizeof(std::int64_t)));
+    TEST_MACRO(usage.values + usage.overhead == std::filesystem::file_size(path));
+    TEST_MACRO(usage.total() % 4096 == 0);
+  }
+}
+
+TEST_CASE("lossy_interval_map") {
+  // Under the budget it behaves exactly like interval_map
+  {
+    lossy_interval_map<int, int> lossy(0, { 16 });
+    interval_map<int, int> exact(0);
+    for (int i = 0; i < 5; ++i) {
+      lossy.assign(i * 10, i * 10 + 5, i + 1);
+      exact.assign(i * 10, i * 10 + 5, i + 1);
+    }
+    TEST_MACRO(lossy.map().map() == exact.map());
+    TEST_MACRO(lossy.error().merges == 0);
+  }
+
+  REQUIRE_THROWS_AS((lossy_interval_map<int, int>(0, { 2 })), std::invalid_argument);
+
+  // Candidates queued while the map stays under budget are pruned too
+  {
+    lossy_interval_map<int, int> lossy(0, { 1000 });
+    std::mt19937 mt(3);
+    std::uniform_int_distribution<int> keyDist(0, 99);
+    std::uniform_int_distribution<int> valDist(1, 100);
+    int overgrown = 0;
+    for (int i = 0; i < 100000; ++i) {
+      const int key = keyDist(mt);
+      lossy.assign(key, key + 1, valDist(mt));
+      overgrown += lossy.candidate_count() > 4 * lossy.map().map().size() + 64;
+    }
+    TEST_MACRO(lossy.error().merges == 0);
+    TEST_MACRO(overgrown == 0);
+  }
+
+  for (lossy_merge policy : { lossy_merge::shortest, lossy_merge::closest_value }) {
+    INFO("policy " << int(policy));
+    std::mt19937 mt(5);
+    std::uniform_int_distribution<int> keyDist(0, 999);
+    std::uniform_int_distribution<int> lenDist(1, 20);
+    std::uniform_int_distribution<int> valDist(0, 100);
+
+    lossy_interval_map<int, int> lossy(0, { 32, policy });
+    interval_map<int, int> exact(0);
+    for (int i = 0; i < 2000; ++i) {
+      const int keyBegin = keyDist(mt);
+      const int keyEnd = keyBegin + lenDist(mt);
+      const int val = valDist(mt);
+      lossy.assign(keyBegin, keyEnd, val);
+      exact.assign(keyBegin, keyEnd, val);
+      TEST_MACRO(lossy.map().map().size() <= 32);
+    }
+
+    // Still canonical
+    const auto& map = lossy.map().map();
+    for (auto it = std::next(map.begin()); it != map.end(); ++it)
+      TEST_MACRO_FALSE(std::prev(it)->second == it->second);
+
+    const auto& error = lossy.error();
+    TEST_MACRO(error.merges > 0);
+    TEST_MACRO(error.maxValueError <= 100);
+
+    // The reported area bounds the actual difference from exact assignment
+    double actual = 0;
+    for (int key = -10; key < 1100; ++key)
+      actual += std::abs(lossy[key] - exact[key]);
+    TEST_MACRO(actual > 0);
+    TEST_MACRO(actual <= error.area);
+  }
+}
+
+TEST_CASE("sparse_interval_map") {
+  // Works with the minimal key and value types
+  {
+    sparse_interval_map<Key, Val> m('A');
+    m.assign(1, 3, 'B');
+    m.assign(3, 5, 'B');
+    m.assign(2, 4, 'A');
+    TEST_MACRO(m.entries().size() == 2);
+    TEST_MACRO(m[0].val() == 'A');
+    TEST_MACRO(m[1].val() == 'B');
+    TEST_MACRO(m[2].val() == 'A');
+    TEST_MACRO(m[4].val() == 'B');
+    TEST_MACRO(m[5].val() == 'A');
+  }
+
+  std::mt19937 mt(3);
+  std::uniform_int_distribution<int> keyDist(0, 499);
+  std::uniform_int_distribution<int> lenDist(0, 30);
+  std::uniform_int_distribution<int> valDist(0, 3);
+
+  sparse_interval_map<int, int> sparse(0);
+  interval_map<int, int> exact(0);
+  for (int i = 0; i < 5000; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    sparse.assign(keyBegin, keyEnd, val);
+    exact.assign(keyBegin, keyEnd, val);
+
+    if (i % 100 == 0) {
+      for (int key = -1; key < 531; ++key)
+        TEST_MACRO(sparse[key] == exact[key]);
+
+      // Canonical: sorted, no defaults, no touching entries of equal value
+      const auto& entries = sparse.entries();
+      for (std::size_t j = 0; j < entries.size(); ++j) {
+        TEST_MACRO(entries[j].keyBegin < entries[j].keyEnd);
+        TEST_MACRO(entries[j].val != 0);
+        if (j > 0) {
+          TEST_MACRO(entries[j - 1].keyEnd <= entries[j].keyBegin);
+          TEST_MACRO_FALSE((entries[j - 1].keyEnd == entries[j].keyBegin && entries[j - 1].val == entries[j].val));
+        }
+      }
+    }
+  }
+
+  // Islands in a sea of the default take one entry instead of two boundaries
+  sparse_interval_map<int, int> islands(0);
+  interval_map<int, int> boundaries(0);
+  for (int i = 0; i < 100; ++i) {
+    islands.assign(i * 10, i * 10 + 5, 1);
+    boundaries.assign(i * 10, i * 10 + 5, 1);
+  }
+  TEST_MACRO(islands.entries().size() == 100);
+  TEST_MACRO(boundaries.map().size() == 201);
+
+  islands.assign(0, 1000, 0);
+  TEST_MACRO(islands.entries().empty());
+  TEST_MACRO(islands.memory_usage().slack > 0);
+  islands.shrink_to_fit();
+  TEST_MACRO(islands.memory_usage().total() == 0);
+}
+
+TEST_CASE("interval_map reset") {
+  interval_map<int, char> m('A');
+  sparse_interval_map<int, char> sparse('A');
+  seqlock_interval_map<int, char> seqlock('A');
+  auto assignAll = [&](int keyBegin, int keyEnd, char val) {
+    m.assign(keyBegin, keyEnd, val);
+    sparse.assign(keyBegin, keyEnd, val);
+    seqlock.assign(keyBegin, keyEnd, val);
+  };
+  // The flat backends already drop a range with one move of the tail in
+  // assign, so only interval_map has a ranged reset
+  auto resetAll = [&](int keyBegin, int keyEnd) {
+    m.reset(keyBegin, keyEnd);
+    sparse.assign(keyBegin, keyEnd, 'A');
+    seqlock.assign(keyBegin, keyEnd, 'A');
+  };
+
+  for (int i = 0; i < 100; ++i)
+    assignAll(i * 10, i * 10 + 5, char('B' + i % 3));
+  assignAll(std::numeric_limits<int>::lowest(), -100, 'C');
+  TEST_MACRO(m.default_value() == 'A');
+
+  resetAll(200, 702);
+  for (int key = -200; key < 1100; ++key) {
+    const char expected = key < -100 ? 'C' : key >= 200 && key < 702 ? 'A' : key >= 0 && key < 1000 && key % 10 < 5 ? char('B' + key / 10 % 3) : 'A';
+    TEST_MACRO(m[key] == expected);
+    TEST_MACRO(sparse[key] == expected);
+    TEST_MACRO(seqlock[key] == expected);
+  }
+  TEST_MACRO(m.map().size() == seqlock.size());
+  TEST_MACRO(sparse.entries().size() == 51);
+
+  // Ranges holding most of the boundaries are dropped wholesale, and give
+  // the same map as assigning the default
+  for (auto range : { std::make_pair(-150, 950), std::make_pair(std::numeric_limits<int>::lowest(), 1000),
+                      std::make_pair(-100, 2000), std::make_pair(5, 995) }) {
+    interval_map<int, char> dropped = m;
+    interval_map<int, char> assigned = m;
+    dropped.reset(range.first, range.second);
+    assigned.assign(range.first, range.second, 'A');
+    TEST_MACRO(dropped.map() == assigned.map());
+  }
+
+  // Resetting the whole key space puts back the lowest boundary
+  m.reset();
+  sparse.reset();
+  seqlock.reset();
+  TEST_MACRO(m.map().size() == 1);
+  TEST_MACRO(m.map().begin()->first == std::numeric_limits<int>::lowest());
+  TEST_MACRO(m[-1000] == 'A');
+  TEST_MACRO(sparse.entries().empty());
+  TEST_MACRO(seqlock.size() == 1);
+  TEST_MACRO(seqlock[-1000] == 'A');
+}
+
+TEST_CASE("interval_map segments") {
+  std::mt19937 mt(9);
+  std::uniform_int_distribution<int> keyDist(0, 299);
+  std::uniform_int_distribution<int> lenDist(1, 30);
+  std::uniform_int_distribution<int> valDist(0, 3);
+
+  interval_map<int, int> m(0);
+  sparse_interval_map<int, int> sparse(0);
+  for (int i = 0; i < 60; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    m.assign(keyBegin, keyEnd, val);
+    sparse.assign(keyBegin, keyEnd, val);
+  }
+  const scratch_dir scratch("interval_map_segments_test");
+  const std::string path = scratch.file("map.bin");
+  m.save(path);
+  const auto mapped = mapped_interval_map<int, int>::open(path);
+
+  // Every backend yields the same segments: contiguous, covering [lo, hi)
+  // exactly, with the values operator[] returns and no two neighbours equal
+  auto check = [&](const auto& view, int lo, int hi) {
+    std::vector<std::tuple<int, int, int>> forward;
+    int expectedBegin = lo;
+    for (const auto& segment : view) {
+      TEST_MACRO(segment.keyBegin == expectedBegin);
+      TEST_MACRO(segment.keyBegin < segment.keyEnd);
+      TEST_MACRO(segment.keyEnd <= hi);
+      TEST_MACRO(segment.val == m[segment.keyBegin]);
+      TEST_MACRO(segment.val == m[segment.keyEnd - 1]);
+      if (!forward.empty())
+        TEST_MACRO(std::get<2>(forward.back()) != segment.val);
+      forward.emplace_back(segment.keyBegin, segment.keyEnd, segment.val);
+      expectedBegin = segment.keyEnd;
+    }
+    TEST_MACRO(expectedBegin == (lo < hi ? hi : lo));
+    TEST_MACRO(view.empty() == forward.empty());
+
+    std::vector<std::tuple<int, int, int>> backward;
+    for (auto it = view.rbegin(); it != view.rend(); ++it)
+      backward.emplace_back((*it).keyBegin, (*it).keyEnd, (*it).val);
+    std::reverse(backward.begin(), backward.end());
+    TEST_MACRO(forward == backward);
+    return forward;
+  };
+
+  std::uniform_int_distribution<int> boundDist(-20, 350);
+  for (int i = 0; i < 500; ++i) {
+    const int lo = boundDist(mt);
+    const int hi = boundDist(mt);
+    const auto expected = check(m.segments(lo, hi), lo, hi);
+    TEST_MACRO(check(mapped.segments(lo, hi), lo, hi) == expected);
+    TEST_MACRO(check(sparse.segments(lo, hi), lo, hi) == expected);
+  }
+
+  // Segments reference the stored values
+  const auto view = m.segments(-5, 5);
+  TEST_MACRO(&(*view.begin()).val == &m.map().begin()->second);
+
+  // An entry at the lowest key leaves no gap before it, so the sparse map's
+  // first run starts there, as interval_map's does
+  {
+    const int lowest = std::numeric_limits<int>::lowest();
+    interval_map<int, int> low(0);
+    sparse_interval_map<int, int> lowSparse(0);
+    low.assign(lowest, 5, 2);
+    low.assign(10, 20, 3);
+    lowSparse.assign(lowest, 5, 2);
+    lowSparse.assign(10, 20, 3);
+
+    auto runs = [](const auto& view) {
+      std::vector<std::tuple<int, int, int>> result;
+      for (const auto& segment : view)
+        result.emplace_back(segment.keyBegin, segment.keyEnd, segment.val);
+      return result;
+    };
+    auto same = [](const auto& a, const auto& b) {
+      return a.keyBegin == b.keyBegin && a.keyEnd == b.keyEnd && a.val == b.val;
+    };
+    for (int lo : { lowest, -5, 0, 5, 12 }) {
+      for (int hi : { lowest, 0, 5, 15, 30 })
+        TEST_MACRO(runs(lowSparse.segments(lo, hi)) == runs(low.segments(lo, hi)));
+
+      TEST_MACRO(same(lowSparse.segment_containing(lo), low.segment_containing(lo)));
+      const auto prev = lowSparse.prev_change(lo);
+      const auto expectedPrev = low.prev_change(lo);
+      TEST_MACRO(prev.has_value() == expectedPrev.has_value());
+      if (prev)
+        TEST_MACRO(same(*prev, *expectedPrev));
+      const auto next = lowSparse.next_change(lo);
+      const auto expectedNext = low.next_change(lo);
+      TEST_MACRO(next.has_value() == expectedNext.has_value());
+      if (next)
+        TEST_MACRO(same(*next, *expectedNext));
+    }
+
+    const auto doubled = combine(lowSparse, lowSparse, [](int a, int b) { return a + b; });
+    TEST_MACRO(doubled[lowest] == 4);
+    TEST_MACRO(doubled[0] == 4);
+    TEST_MACRO(doubled[5] == 0);
+    TEST_MACRO(doubled[10] == 6);
+  }
+
+}
+
+TEST_CASE("interval_map change navigation") {
+  std::mt19937 mt(13);
+  std::uniform_int_distribution<int> keyDist(0, 199);
+  std::uniform_int_distribution<int> lenDist(1, 20);
+  std::uniform_int_distribution<int> valDist(0, 3);
+
+  interval_map<int, int> m(0);
+  sparse_interval_map<int, int> sparse(0);
+  for (int i = 0; i < 40; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    m.assign(keyBegin, keyEnd, val);
+    sparse.assign(keyBegin, keyEnd, val);
+  }
+  const scratch_dir scratch("interval_map_navigation_test");
+  const std::string path = scratch.file("map.bin");
+  m.save(path);
+  const auto mapped = mapped_interval_map<int, int>::open(path);
+
+  // Runs are maximal, so on every backend they end where operator[] changes
+  auto check = [&](const auto& map) {
+    int runs = 0;
+    std::optional<int> key = -50;
+    while (key) {
+      const auto run = map.segment_containing(*key);
+      TEST_MACRO(run.val == m[*key]);
+      if (run.keyBegin) {
+        TEST_MACRO(*run.keyBegin <= *key);
+        TEST_MACRO(m[*run.keyBegin - 1] != run.val);
+      }
+      if (run.keyEnd) {
+        TEST_MACRO(*key < *run.keyEnd);
+        TEST_MACRO(m[*run.keyEnd] != run.val);
+        TEST_MACRO(m[*run.keyEnd - 1] == run.val);
+      }
+
+      const auto next = map.next_change(*key);
+      TEST_MACRO(next.has_value() == run.keyEnd.has_value());
+      if (next)
+        TEST_MACRO(next->keyBegin == run.keyEnd);
+      const auto prev = map.prev_change(*key);
+      TEST_MACRO(prev.has_value() == run.keyBegin.has_value());
+      if (prev) {
+        TEST_MACRO(prev->keyEnd == run.keyBegin);
+        TEST_MACRO(prev->val != run.val);
+      }
+
+      // Skip the whole run in one call
+      key = run.keyEnd;
+      ++runs;
+    }
+    return runs;
+  };
+
+  const int runs = check(m);
+  TEST_MACRO(runs == int(m.map().size()));
+  TEST_MACRO(check(mapped) == runs);
+  TEST_MACRO(check(sparse) == runs);
+
+}
+
+TEST_CASE("interval_map combine") {
+  // Works with the minimal key and value types
+  {
+    interval_map<Key, Val> a('A');
+    interval_map<Key, Val> b('A');
+    a.assign(0, 10, 'B');
+    b.assign(5, 15, 'B');
+    const auto both = combine(a, b, [](Val const& x, Val const& y) {
+      return Val(x == y ? x.val() : 'C');
+    });
+    TEST_MACRO(both.map().size() == 5);
+    a.combine(b, [](Val const& x, Val const& y) { return Val(x == y ? x.val() : 'C'); });
+    TEST_MACRO(a.map().size() == 5);
+    checkCanonicity(a);
+  }
+
+  std::mt19937 mt(17);
+  std::uniform_int_distribution<int> keyDist(0, 299);
+  std::uniform_int_distribution<int> lenDist(1, 30);
+  std::uniform_int_distribution<int> valDist(0, 4);
+
+  for (int round = 0; round < 20; ++round) {
+    interval_map<int, int> a(0);
+    interval_map<int, int> b(round % 2 ? 1 : 0);
+    sparse_interval_map<int, int> sparseA(0);
+    sparse_interval_map<int, int> sparseB(round % 2 ? 1 : 0);
+    for (int i = 0; i < 40; ++i) {
+      const int keyBegin = keyDist(mt);
+      const int keyEnd = keyBegin + lenDist(mt);
+      const int val = valDist(mt);
+      if (i % 2) {
+        a.assign(keyBegin, keyEnd, val);
+        sparseA.assign(keyBegin, keyEnd, val);
+      }
+      else {
+        b.assign(keyBegin, keyEnd, val);
+        sparseB.assign(keyBegin, keyEnd, val);
+      }
+    }
+    if (round % 4 == 0)
+      a.assign(std::numeric_limits<int>::lowest(), -10, 3);
+
+    auto max = [](int x, int y) { return std::max(x, y); };
+    const auto combined = combine(a, b, max);
+    const auto sum = combine(a, b, [](int x, int y) { return std::int64_t(x) + y; });
+    interval_map<int, int> inPlace = a;
+    inPlace.combine(b, max);
+    TEST_MACRO(inPlace.map() == combined.map());
+    TEST_MACRO(combined.default_value() == max(a.default_value(), b.default_value()));
+
+    const auto sparseCombined = combine(sparseA, sparseB, max);
+    sparse_interval_map<int, int> sparseInPlace = sparseA;
+    sparseInPlace.combine(sparseB, max);
+    TEST_MACRO(sparseInPlace.entries().size() == sparseCombined.entries().size());
+
+    for (int key = -20; key < 340; ++key) {
+      TEST_MACRO(combined[key] == std::max(a[key], b[key]));
+      TEST_MACRO(sum[key] == a[key] + b[key]);
+      if (round % 4 != 0) {
+        TEST_MACRO(sparseCombined[key] == combined[key]);
+        TEST_MACRO(sparseInPlace[key] == combined[key]);
+      }
+    }
+
+    // Canonical
+    const auto& map = combined.map();
+    for (auto it = std::next(map.begin()); it != map.end(); ++it)
+      TEST_MACRO(std::prev(it)->second != it->second);
+    const auto& entries = sparseCombined.entries();
+    for (std::size_t j = 0; j < entries.size(); ++j) {
+      TEST_MACRO(entries[j].val != sparseCombined.default_value());
+      if (j > 0)
+        TEST_MACRO_FALSE((entries[j - 1].keyEnd == entries[j].keyBegin && entries[j - 1].val == entries[j].val));
+    }
+  }
+
+  std::vector<std::pair<int, int>> unbounded = { { 5, 1 } };
+  REQUIRE_THROWS_AS((sparse_interval_map<int, int>(0, unbounded.begin(), unbounded.end())), std::invalid_argument);
+}
+
+TEST_CASE("interval_map overlay") {
+  std::mt19937 mt(19);
+  std::uniform_int_distribution<int> keyDist(0, 299);
+  std::uniform_int_distribution<int> lenDist(1, 40);
+  std::uniform_int_distribution<int> valDist(0, 5);
+
+  std::vector<interval_map<int, int>> layers;
+  for (int layer = 0; layer < 12; ++layer) {
+    layers.emplace_back(layer == 0 ? 7 : 0);
+    for (int i = 0; i < 10; ++i) {
+      const int keyBegin = keyDist(mt);
+      layers.back().assign(keyBegin, keyBegin + lenDist(mt), valDist(mt));
+    }
+  }
+  layers[3].assign(std::numeric_limits<int>::lowest(), -5, 9);
+
+  // Applying each layer's segments in order gives the same result, with
+  // default regions skipped
+  interval_map<int, int> expected(7);
+  for (const auto& layer : layers) {
+    const auto& map = layer.map();
+    for (auto it = map.begin(); it != map.end(); ++it) {
+      if (&layer != &layers.front() && it->second == layer.default_value())
+        continue;
+      const int keyEnd = std::next(it) == map.end() ? std::numeric_limits<int>::max() : std::next(it)->first;
+      expected.assign(it->first, keyEnd, it->second);
+    }
+  }
+
+  const auto result = overlay(layers.begin(), layers.end());
+  TEST_MACRO(result.default_value() == 7);
+  for (int key = -20; key < 360; ++key)
+    TEST_MACRO(result[key] == expected[key]);
+  const auto& map = result.map();
+  for (auto it = std::next(map.begin()); it != map.end(); ++it)
+    TEST_MACRO(std::prev(it)->second != it->second);
+
+  // Opaque layers hide everything below them
+  const auto opaque = overlay(layers.begin(), layers.end(), false);
+  TEST_MACRO(opaque.map() == layers.back().map());
+  const auto single = overlay(layers.begin(), layers.begin() + 1);
+  TEST_MACRO(single.map() == layers.front().map());
+
+  REQUIRE_THROWS_AS(overlay(layers.begin(), layers.begin()), std::invalid_argument);
+}
+
+TEST_CASE("interval_map update") {
+  // Works with the minimal key and value types
+  {
+    interval_map<Key, Val> m('A');
+    m.assign(0, 10, 'B');
+    m.update(5, 15, [](Val const& v) { return Val(v.val() == 'A' ? 'B' : 'C'); });
+    TEST_MACRO(m[4].val() == 'B');
+    TEST_MACRO(m[5].val() == 'C');
+    TEST_MACRO(m[10].val() == 'B');
+    TEST_MACRO(m[15].val() == 'A');
+    checkCanonicity(m);
+  }
+
+  std::mt19937 mt(23);
+  std::uniform_int_distribution<int> keyDist(0, 199);
+  std::uniform_int_distribution<int> lenDist(0, 40);
+  std::uniform_int_distribution<int> valDist(0, 3);
+
+  interval_map<int, int> m(0);
+  std::vector<int> expected(260, 0);
+  for (int i = 0; i < 2000; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    switch (i % 3) {
+    case 0:
+      m.assign(keyBegin, keyEnd, val);
+      for (int key = keyBegin; key < keyEnd; ++key)
+        expected[key] = val;
+      break;
+    case 1:
+      // Saturating increment, so runs also merge
+      m.update(keyBegin, keyEnd, [](int v) { return std::min(v + 1, 3); });
+      for (int key = keyBegin; key < keyEnd; ++key)
+        expected[key] = std::min(expected[key] + 1, 3);
+      break;
+    default:
+      m.update(keyBegin, keyEnd, [&](int v) { return v | val; });
+      for (int key = keyBegin; key < keyEnd; ++key)
+        expected[key] |= val;
+      break;
+    }
+
+    if (i % 50 == 0) {
+      for (int key = 0; key < 260; ++key)
+        TEST_MACRO(m[key] == expected[key]);
+      const auto& map = m.map();
+      for (auto it = std::next(map.begin()); it != map.end(); ++it)
+        TEST_MACRO(std::prev(it)->second != it->second);
+    }
+  }
+
+  // Updating from the lowest key changes the first boundary in place
+  m.update(std::numeric_limits<int>::lowest(), 0, [](int v) { return v + 5; });
+  TEST_MACRO(m.map().begin()->first == std::numeric_limits<int>::lowest());
+  TEST_MACRO(m[-1] == 5);
+  TEST_MACRO(m[0] == expected[0]);
+}
+
+TEST_CASE("numeric_interval_map") {
+  REQUIRE_THROWS_AS((numeric_interval_map<int, int>(0, 5, 5)), std::invalid_argument);
+
+  const int domainBegin = -50;
+  const int domainEnd = 150;
+  numeric_interval_map<int, int> m(3, domainBegin, domainEnd);
+  std::vector<std::int64_t> expected(domainEnd - domainBegin, 3);
+
+  std::mt19937 mt(29);
+  std::uniform_int_distribution<int> keyDist(domainBegin - 10, domainEnd + 10);
+  std::uniform_int_distribution<int> valDist(-20, 20);
+  for (int i = 0; i < 3000; ++i) {
+    int keyBegin = keyDist(mt);
+    int keyEnd = keyDist(mt);
+    if (keyEnd < keyBegin)
+      std::swap(keyBegin, keyEnd);
+    const int val = valDist(mt);
+    if (i % 4 == 0)
+      m.assign(keyBegin, keyEnd, val);
+    else
+      m.add(keyBegin, keyEnd, val);
+    for (int key = std::max(keyBegin, domainBegin); key < std::min(keyEnd, domainEnd); ++key)
+      expected[key - domainBegin] = i % 4 == 0 ? val : expected[key - domainBegin] + val;
+
+    // Aggregate a random range of the domain
+    int queryBegin = keyDist(mt);
+    int queryEnd = keyDist(mt);
+    if (queryEnd < queryBegin)
+      std::swap(queryBegin, queryEnd);
+    queryBegin = std::max(queryBegin, domainBegin);
+    queryEnd = std::min(queryEnd, domainEnd);
+    if (queryBegin < queryEnd) {
+      const auto aggregate = m.aggregate(queryBegin, queryEnd);
+      std::int64_t sum = 0;
+      std::int64_t min = std::numeric_limits<std::int64_t>::max();
+      std::int64_t max = std::numeric_limits<std::int64_t>::lowest();
+      for (int key = queryBegin; key < queryEnd; ++key) {
+        sum += expected[key - domainBegin];
+        min = std::min(min, expected[key - domainBegin]);
+        max = std::max(max, expected[key - domainBegin]);
+      }
+      TEST_MACRO(aggregate.sum == sum);
+      TEST_MACRO(aggregate.min == min);
+      TEST_MACRO(aggregate.max == max);
+    }
+
+    if (i % 100 == 0) {
+      for (int key = domainBegin; key < domainEnd; ++key)
+        TEST_MACRO(m[key] == expected[key - domainBegin]);
+    }
+  }
+
+  // Assigning the whole domain frees the tree for reuse
+  m.assign(domainBegin, domainEnd, 1);
+  TEST_MACRO(m.aggregate(domainBegin, domainEnd).sum == domainEnd - domainBegin);
+  TEST_MACRO(m.memory_usage().values < 100);
+  REQUIRE_THROWS_AS(m[domainEnd], std::out_of_range);
+  REQUIRE_THROWS_AS(m.aggregate(domainEnd, domainEnd + 5), std::out_of_range);
+
+  // Domains spanning all of K, with sums wider than V
+  numeric_interval_map<std::int32_t, std::int32_t> wide(1, std::numeric_limits<std::int32_t>::lowest(),
+    std::numeric_limits<std::int32_t>::max());
+  wide.add(-10, 10, 1000000);
+  const auto total = wide.aggregate(std::numeric_limits<std::int32_t>::lowest(), std::numeric_limits<std::int32_t>::max());
+  TEST_MACRO(total.sum == std::int64_t(std::numeric_limits<std::uint32_t>::max()) + 20 * 1000000ll);
+  TEST_MACRO(total.min == 1);
+  TEST_MACRO(total.max == 1000001);
+  TEST_MACRO(wide[9] == 1000001);
+  TEST_MACRO(wide[10] == 1);
+}
+
+TEST_CASE("augmented_interval_map") {
+  std::mt19937 mt(31);
+  std::uniform_int_distribution<int> keyDist(-20, 220);
+  std::uniform_int_distribution<int> lenDist(1, 50);
+  std::uniform_int_distribution<int> valDist(0, 4);
+
+  augmented_interval_map<int, int, weighted_sum<int, int>> sums(1);
+  augmented_interval_map<int, int, value_histogram<int, int>> histogram(1);
+  interval_map<int, int> exact(1);
+  for (int i = 0; i < 1500; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    sums.assign(keyBegin, keyEnd, val);
+    histogram.assign(keyBegin, keyEnd, val);
+    exact.assign(keyBegin, keyEnd, val);
+
+    // Same canonical boundaries as interval_map
+    if (i % 100 == 0) {
+      std::vector<std::pair<int, int>> boundaries;
+      sums.for_each_boundary([&](int key, int val) { boundaries.emplace_back(key, val); });
+      TEST_MACRO(boundaries == std::vector<std::pair<int, int>>(exact.map().begin(), exact.map().end()));
+      TEST_MACRO(sums.size() == exact.map().size());
+      for (int key = -30; key < 280; ++key)
+        TEST_MACRO(sums[key] == exact[key]);
+    }
+
+    int lo = keyDist(mt) - 20;
+    int hi = keyDist(mt) + 40;
+    if (hi < lo)
+      std::swap(lo, hi);
+    double sum = 0;
+    std::map<int, std::uint64_t> coverage;
+    for (int key = lo; key < hi; ++key) {
+      sum += exact[key];
+      ++coverage[exact[key]];
+    }
+    TEST_MACRO(sums.aggregate(lo, hi) == sum);
+    TEST_MACRO(histogram.aggregate(lo, hi) == coverage);
+  }
+
+  TEST_MACRO(sums.aggregate(5, 5) == 0);
+  TEST_MACRO(histogram.aggregate(5, 4).empty());
+
+  // Copies are independent
+  auto copy = sums;
+  copy.assign(0, 100, 0);
+  TEST_MACRO(copy.aggregate(0, 100) == 0);
+  TEST_MACRO(sums.aggregate(0, 100) != 0);
+}
+
+TEST_CASE("interval_map order statistics") {
+  std::mt19937 mt(37);
+  std::uniform_int_distribution<int> keyDist(0, 499);
+  std::uniform_int_distribution<int> lenDist(1, 30);
+  std::uniform_int_distribution<int> valDist(0, 5);
+
+  augmented_interval_map<int, int, weighted_sum<int, int>> tree(0);
+  interval_map<int, int> exact(0);
+  for (int i = 0; i < 300; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    tree.assign(keyBegin, keyEnd, val);
+    exact.assign(keyBegin, keyEnd, val);
+  }
+  const scratch_dir scratch("interval_map_order_test");
+  const std::string path = scratch.file("map.bin");
+  exact.save(path);
+  const auto mapped = mapped_interval_map<int, int>::open(path);
+
+  const std::vector<std::pair<int, int>> boundaries(exact.map().begin(), exact.map().end());
+  TEST_MACRO(tree.size() == boundaries.size());
+
+  auto check = [&](const auto& map) {
+    for (std::size_t k = 0; k < boundaries.size(); ++k) {
+      const auto run = map.nth_segment(k);
+      TEST_MACRO(run.val == boundaries[k].second);
+      TEST_MACRO(run.keyBegin.has_value() == (k > 0));
+      if (k > 0)
+        TEST_MACRO(*run.keyBegin == boundaries[k].first);
+      TEST_MACRO(run.keyEnd.has_value() == (k + 1 < boundaries.size()));
+      if (k + 1 < boundaries.size())
+        TEST_MACRO(*run.keyEnd == boundaries[k + 1].first);
+    }
+    REQUIRE_THROWS_AS(map.nth_segment(boundaries.size()), std::out_of_range);
+
+    for (int key = -10; key < 540; key += 3) {
+      const std::size_t rank = map.rank(key);
+      TEST_MACRO(!(key < boundaries[rank].first));
+      TEST_MACRO((rank + 1 == boundaries.size() || key < boundaries[rank + 1].first));
+
+      const int hi = key + lenDist(mt);
+      std::size_t count = 0;
+      for (const auto& segment : exact.segments(key, hi)) {
+        (void)segment;
+        ++count;
+      }
+      TEST_MACRO(map.count_segments(key, hi) == count);
+      TEST_MACRO(map.count_segments(hi, key) == 0);
+    }
+  };
+  check(tree);
+  check(mapped);
+
+}
+
+TEST_CASE("indexed_interval_map") {
+  std::mt19937 mt(47);
+  std::uniform_int_distribution<int> keyDist(0, 299);
+  std::uniform_int_distribution<int> lenDist(1, 25);
+  std::uniform_int_distribution<int> valDist(0, 6);
+
+  indexed_interval_map<int, int> indexed(0);
+  interval_map<int, int> exact(0);
+
+  // find_all must list exactly the runs of the plain map holding each value
+  auto check = [&](const indexed_interval_map<int, int>& map) {
+    TEST_MACRO(map.map().map() == exact.map());
+    for (int val = 0; val <= 7; ++val) {
+      std::vector<std::tuple<std::optional<int>, std::optional<int>>> expected;
+      for (auto it = exact.map().begin(); it != exact.map().end(); ++it) {
+        if (it->second != val)
+          continue;
+        auto next = std::next(it);
+        expected.emplace_back(it == exact.map().begin() ? std::nullopt : std::optional<int>(it->first),
+          next == exact.map().end() ? std::nullopt : std::optional<int>(next->first));
+      }
+
+      const auto runs = map.find_all(val);
+      TEST_MACRO(runs.size() == expected.size());
+      TEST_MACRO(map.count(val) == expected.size());
+      for (std::size_t i = 0; i < runs.size() && i < expected.size(); ++i) {
+        TEST_MACRO(runs[i].val == val);
+        TEST_MACRO(runs[i].keyBegin == std::get<0>(expected[i]));
+        TEST_MACRO(runs[i].keyEnd == std::get<1>(expected[i]));
+      }
+    }
+  };
+
+  // Rebuild the plain map with every boundary holding from moved to to
+  auto replaceExact = [&](int from, int to) {
+    std::vector<std::pair<int, int>> boundaries(exact.map().begin(), exact.map().end());
+    for (auto& boundary : boundaries) {
+      if (boundary.second == from)
+        boundary.second = to;
+    }
+    exact = interval_map<int, int>(0, boundaries.begin(), boundaries.end());
+  };
+
+  for (int i = 0; i < 2000; ++i) {
+    if (i % 50 == 49) {
+      // Replace every occurrence, including the unbounded runs at either end
+      const int from = valDist(mt);
+      const int to = valDist(mt);
+      indexed.replace_value(from, to);
+      replaceExact(from, to);
+    }
+    else {
+      const int keyBegin = keyDist(mt);
+      const int keyEnd = keyBegin + lenDist(mt);
+      const int val = valDist(mt);
+      indexed.assign(keyBegin, keyEnd, val);
+      exact.assign(keyBegin, keyEnd, val);
+    }
+    check(indexed);
+  }
+
+  // Runs reaching the end of the key space are replaced too
+  indexed.assign(100, 200, 7);
+  exact.assign(100, 200, 7);
+  const int last = exact[1000];
+  indexed.replace_value(last, 7);
+  replaceExact(last, 7);
+  TEST_MACRO(indexed[1000] == 7);
+  check(indexed);
+
+  const indexed_interval_map<int, int> copy = indexed;
+  indexed.replace_value(7, 0);
+  check(copy);
+  TEST_MACRO(indexed.count(7) == 0);
+}
+
+TEST_CASE("shifting_interval_map") {
+  std::mt19937 mt(48);
+  std::uniform_int_distribution<int> opDist(0, 3);
+  std::uniform_int_distribution<int> lenDist(1, 20);
+  std::uniform_int_distribution<int> valDist(0, 4);
+
+  // The values of keys [0, text.size()) as a flat sequence; every other key
+  // holds 0, as it was never assigned
+  shifting_interval_map<int, int> map(0);
+  std::vector<int> text(200, 0);
+
+  for (int i = 0; i < 2000; ++i) {
+    std::uniform_int_distribution<int> posDist(0, int(text.size()));
+    const int pos = posDist(mt);
+    const int len = lenDist(mt);
+    switch (opDist(mt)) {
+    case 0:
+    case 1: {
+      const int end = std::min(pos + len, int(text.size()));
+      const int val = valDist(mt);
+      map.assign(pos, end, val);
+      std::fill(text.begin() + pos, text.begin() + end, val);
+      break;
+    }
+    case 2: {
+      map.insert_gap(pos, len);
+      text.insert(text.begin() + pos, len, pos == 0 ? 0 : text[pos - 1]);
+      break;
+    }
+    default: {
+      const int end = std::min(pos + len, int(text.size()));
+      map.remove_span(pos, end - pos);
+      text.erase(text.begin() + pos, text.begin() + end);
+      break;
+    }
+    }
+
+    for (int key = -3; key < int(text.size()) + 3; ++key)
+      TEST_MACRO(map[key] == (key < 0 || key >= int(text.size()) ? 0 : text[key]));
+    TEST_MACRO(map[std::numeric_limits<int>::lowest()] == 0);
+    TEST_MACRO(map[std::numeric_limits<int>::max()] == 0);
+
+    std::vector<std::pair<int, int>> boundaries;
+    map.for_each_boundary([&](int key, int val) { boundaries.emplace_back(key, val); });
+    TEST_MACRO(boundaries.size() == map.size());
+    TEST_MACRO(boundaries.front().first == std::numeric_limits<int>::lowest());
+    for (std::size_t b = 1; b < boundaries.size(); ++b) {
+      TEST_MACRO(boundaries[b - 1].first < boundaries[b].first);
+      TEST_MACRO(boundaries[b - 1].second != boundaries[b].second);
+    }
+  }
+
+  // Shifts that would run off the end of the key space are refused, and
+  // leave the map as it was
+  map.assign(std::numeric_limits<int>::max() - 5, std::numeric_limits<int>::max(), 7);
+  const shifting_interval_map<int, int> copy = map;
+  REQUIRE_THROWS_AS(map.insert_gap(0, 10), std::out_of_range);
+  REQUIRE_THROWS_AS(map.remove_span(std::numeric_limits<int>::max() - 5, 10), std::out_of_range);
+  for (int key = -3; key < int(text.size()) + 3; ++key)
+    TEST_MACRO(map[key] == copy[key]);
+  TEST_MACRO(map[std::numeric_limits<int>::max() - 1] == 7);
+  TEST_MACRO(map.size() == copy.size());
+
+  // A gap at the lowest key leaves the first boundary where it is
+  shifting_interval_map<int, int> low(1);
+  low.assign(std::numeric_limits<int>::lowest() + 2, 0, 2);
+  low.insert_gap(std::numeric_limits<int>::lowest(), 3);
+  TEST_MACRO(low[std::numeric_limits<int>::lowest()] == 1);
+  TEST_MACRO(low[std::numeric_limits<int>::lowest() + 4] == 1);
+  TEST_MACRO(low[std::numeric_limits<int>::lowest() + 5] == 2);
+  TEST_MACRO(low[2] == 2);
+  TEST_MACRO(low[3] == 1);
+}
+
+TEST_CASE("interval_map split_at and concat") {
+  std::mt19937 mt(49);
+  std::uniform_int_distribution<int> keyDist(0, 499);
+  std::uniform_int_distribution<int> lenDist(1, 30);
+  std::uniform_int_distribution<int> valDist(0, 4);
+
+  auto boundariesOf = [](const auto& map) {
+    std::vector<std::pair<int, int>> boundaries;
+    map.for_each_boundary([&](int key, int val) { boundaries.emplace_back(key, val); });
+    return boundaries;
+  };
+
+  auto check = [&](auto map) {
+    for (int i = 0; i < 200; ++i) {
+      const int keyBegin = keyDist(mt);
+      map.assign(keyBegin, keyBegin + lenDist(mt), valDist(mt));
+    }
+    const auto original = boundariesOf(map);
+
+    for (int i = 0; i < 100; ++i) {
+      const int key = i == 0 ? std::numeric_limits<int>::lowest() : keyDist(mt) - 10;
+      auto lower = map;
+      auto upper = lower.split_at(key);
+      TEST_MACRO(lower.size() == boundariesOf(lower).size());
+      TEST_MACRO(upper.size() == boundariesOf(upper).size());
+
+      // Each part holds the original on its side of key and the value just
+      // below key on the other
+      const int seamVal = key == std::numeric_limits<int>::lowest() ? map[key] : map[key - 1];
+      for (int probe = -20; probe < 560; probe += 7) {
+        TEST_MACRO(lower[probe] == (probe < key ? map[probe] : seamVal));
+        TEST_MACRO(upper[probe] == (probe < key ? seamVal : map[probe]));
+      }
+
+      const auto joined = concat(std::move(lower), std::move(upper));
+      TEST_MACRO(boundariesOf(joined) == original);
+      TEST_MACRO(joined.size() == original.size());
+    }
+
+    // Maps whose boundaries interleave can't be joined
+    auto upper = map;
+    auto lower = map;
+    REQUIRE_THROWS_AS(concat(lower, upper), std::invalid_argument);
+
+    // A seam between equal values is merged away
+    decltype(map) left(1);
+    left.assign(10, 20, 2);
+    decltype(map) right(5);
+    right.assign(30, 40, 1);
+    right.assign(40, 50, 3);
+    const auto joined = concat(std::move(left), std::move(right));
+    const std::vector<std::pair<int, int>> expected = {
+      { std::numeric_limits<int>::lowest(), 1 }, { 10, 2 }, { 20, 1 }, { 40, 3 }, { 50, 5 }
+    };
+    TEST_MACRO(boundariesOf(joined) == expected);
+    TEST_MACRO(joined.size() == expected.size());
+    TEST_MACRO(joined[35] == 1);
+  };
+
+  check(augmented_interval_map<int, int, weighted_sum<int, int>>(0));
+  check(shifting_interval_map<int, int>(0));
+}
+
+TEST_CASE("persistent_interval_map") {
+  std::mt19937 mt(50);
+  std::uniform_int_distribution<int> keyDist(0, 99999);
+  std::uniform_int_distribution<int> lenDist(1, 40);
+  std::uniform_int_distribution<int> valDist(0, 5);
+
+  auto boundariesOf = [](const persistent_interval_map<int, int>& map) {
+    std::vector<std::pair<int, int>> boundaries;
+    map.for_each_boundary([&](int key, int val) { boundaries.emplace_back(key, val); });
+    return boundaries;
+  };
+
+  persistent_interval_map<int, int> base(0);
+  interval_map<int, int> exactBase(0);
+  for (int i = 0; i < 5000; ++i) {
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    base.assign(keyBegin, keyEnd, val);
+    exactBase.assign(keyBegin, keyEnd, val);
+  }
+  const auto baseBoundaries = boundariesOf(base);
+  TEST_MACRO(baseBoundaries == std::vector<std::pair<int, int>>(exactBase.map().begin(), exactBase.map().end()));
+  TEST_MACRO(base.size() == baseBoundaries.size());
+
+  // Copies start out sharing every node with the base
+  std::vector<persistent_interval_map<int, int>> copies(20, base);
+  std::vector<interval_map<int, int>> exact(20, exactBase);
+  TEST_MACRO(copies.front().memory_usage().total() == 0);
+
+  for (int i = 0; i < 200; ++i) {
+    const std::size_t copy = i % copies.size();
+    const int keyBegin = keyDist(mt);
+    const int keyEnd = keyBegin + lenDist(mt);
+    const int val = valDist(mt);
+    copies[copy].assign(keyBegin, keyEnd, val);
+    exact[copy].assign(keyBegin, keyEnd, val);
+  }
+
+  // Each copy only sees its own changes, and the base none of them
+  TEST_MACRO(boundariesOf(base) == baseBoundaries);
+  std::size_t unshared = 0;
+  for (std::size_t copy = 0; copy < copies.size(); ++copy) {
+    TEST_MACRO(boundariesOf(copies[copy]) == std::vector<std::pair<int, int>>(exact[copy].map().begin(), exact[copy].map().end()));
+    for (int key = -5; key < 100050; key += 37)
+      TEST_MACRO(copies[copy][key] == exact[copy][key]);
+    unshared += copies[copy].memory_usage().values / (sizeof(int) + sizeof(int));
+  }
+
+  // Ten assignments per copy rebuild a few paths, not whole trees
+  TEST_MACRO(unshared < copies.size() * baseBoundaries.size() / 4);
+
+  // Dropping the base leaves the copies intact
+  base = persistent_interval_map<int, int>(0);
+  TEST_MACRO(base.size() == 1);
+  TEST_MACRO(boundariesOf(copies.front()) == std::vector<std::pair<int, int>>(exact.front().map().begin(), exact.front().map().end()));
+}
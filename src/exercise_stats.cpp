@@ -0,0 +1,77 @@
+// Tests of the operation counters and latency histograms, built into their
+// own executable with INTERVAL_MAP_STATS defined, so the other tests run
+// interval_map as it is by default, without them
+#include "interval_map.hpp"
+
+#include <catch.hpp>
+#include <vector>
+
+#define TEST_MACRO REQUIRE
+#define TEST_MACRO_FALSE REQUIRE_FALSE
+
+TEST_CASE("interval_map stats") {
+  interval_map<int, char> m('A');
+
+  m.assign(5, 5, 'B');
+  m.assign(10, 20, 'B');
+  m.assign(15, 30, 'B');
+  m.assign(0, 40, 'A');
+  m.assign(1, 2, 'A');
+
+  auto stats = m.stats();
+  TEST_MACRO(stats.assigns == 5);
+  TEST_MACRO(stats.noopAssigns == 1);
+  // [10,20) adds two boundaries, [15,30) moves the end one, [0,40) erases
+  // everything but the lowest and [1,2) changes nothing
+  TEST_MACRO(stats.insertedBoundaries == 3);
+  TEST_MACRO(stats.erasedBoundaries == 3);
+  TEST_MACRO(stats.coalescedBoundaries == 5);
+  TEST_MACRO(stats.assignLatency.count() == 4);
+  TEST_MACRO(stats.insertedBoundaries + 1 - stats.erasedBoundaries == m.map().size());
+
+  for (int i = 0; i < 100; ++i)
+    m[i];
+  stats = m.stats();
+  TEST_MACRO(stats.lookups == 100);
+  TEST_MACRO(stats.lookupLatency.count() == 100);
+  TEST_MACRO(stats.lookupLatency.quantile(0.5) <= stats.lookupLatency.quantile(0.99));
+  TEST_MACRO(stats.lookupLatency.quantile(0.99) > 0);
+
+  // Lookups from several threads are all counted
+  work_stealing_pool pool(4);
+  std::vector<int> keys(10000);
+  for (int i = 0; i < int(keys.size()); ++i)
+    keys[i] = i;
+  std::vector<char> out(keys.size());
+  m.parallel_lookup(keys.begin(), keys.end(), out.begin(), pool);
+  TEST_MACRO(m.stats().lookups == 10100);
+
+  m.reset_stats();
+  TEST_MACRO(m.stats().lookups == 0);
+  TEST_MACRO(m.stats().lookupLatency.count() == 0);
+
+  latency_histogram h;
+  TEST_MACRO(h.quantile(0.5) == 0);
+  TEST_MACRO(latency_histogram::bucket(0) == 0);
+  TEST_MACRO(latency_histogram::bucket(1) == 0);
+  TEST_MACRO(latency_histogram::bucket(1000) == 9);
+  TEST_MACRO(latency_histogram::bucket(~0ull) == latency_histogram::bucket_count - 1);
+  h.buckets[3] = 10;
+  h.buckets[9] = 1;
+  TEST_MACRO(h.quantile(0.5) == 16);
+  TEST_MACRO(h.quantile(1) == 1024);
+
+  // assign_from and reset count as assigns too
+  interval_map<int, char> n('A');
+  for (int i = 0; i < 10; ++i)
+    n.assign(i * 10, i * 10 + 5, 'B');
+  n.assign_from(42, 'C');
+  n.assign_from(50, 'C');
+  n.reset(-5, 1000);
+  stats = n.stats();
+  TEST_MACRO(stats.assigns == 13);
+  TEST_MACRO(stats.assignLatency.count() == 13);
+  // The second assign_from and the start of the reset change nothing
+  TEST_MACRO(stats.coalescedBoundaries == 2);
+  TEST_MACRO(stats.insertedBoundaries + 1 - stats.erasedBoundaries == n.map().size());
+}
@@ -0,0 +1,143 @@
+#pragma once
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <map>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "interval_map.hpp"
+#include "interval_segments.hpp"
+
+// interval_map with an inverted index from each value to the boundaries
+// holding it, so the runs of a value can be found without scanning the map.
+// The index keeps the boundaries of a value in key order, each with an
+// iterator to its node in the map; std::map never moves nodes, so only the
+// boundaries assign erases or inserts need updating, and those are the ones
+// in [keyBegin, keyEnd]. V must be hashable with Hash.
+template<typename K, typename V, typename Hash = std::hash<V>>
+class indexed_interval_map {
+  using node_iterator = typename std::map<K, V>::const_iterator;
+  using boundary_set = std::map<K, node_iterator>;
+
+  interval_map<K, V> m_map;
+  std::unordered_map<V, boundary_set, Hash> m_index;
+
+  // Take the boundaries of the map in [it, end) out of the index, or put
+  // them in
+  void unindex(node_iterator it, node_iterator end) {
+    for (; it != end; ++it) {
+      auto found = m_index.find(it->second);
+      found->second.erase(it->first);
+      if (found->second.empty())
+        m_index.erase(found);
+    }
+  }
+
+  void index(node_iterator it, node_iterator end) {
+    for (; it != end; ++it) {
+      auto& boundaries = m_index[it->second];
+      boundaries.emplace_hint(boundaries.end(), it->first, it);
+    }
+  }
+
+  // Run the map update f, reindexing the boundaries from keyBegin to keyEnd
+  // (or to the end of the map if keyEnd is null), which are the only ones it
+  // may erase or insert
+  template<typename F>
+  void reindexed(K const& keyBegin, const K* keyEnd, F f) {
+    const auto& map = m_map.map();
+    unindex(map.lower_bound(keyBegin), keyEnd ? map.upper_bound(*keyEnd) : map.end());
+    f();
+    index(map.lower_bound(keyBegin), keyEnd ? map.upper_bound(*keyEnd) : map.end());
+  }
+
+public:
+  // constructor associates whole range of K with val
+  indexed_interval_map(V const& val) : m_map(val) {
+    index(m_map.map().begin(), m_map.map().end());
+  }
+
+  // The index points into the map it was built for, so copies rebuild it
+  indexed_interval_map(const indexed_interval_map& other) : m_map(other.m_map) {
+    index(m_map.map().begin(), m_map.map().end());
+  }
+
+  indexed_interval_map& operator=(const indexed_interval_map& other) {
+    if (this != &other) {
+      m_map = other.m_map;
+      m_index.clear();
+      index(m_map.map().begin(), m_map.map().end());
+    }
+    return *this;
+  }
+
+  indexed_interval_map(indexed_interval_map&&) = default;
+  indexed_interval_map& operator=(indexed_interval_map&&) = default;
+
+  // Assign value val to interval [keyBegin, keyEnd), as interval_map::assign,
+  // in O(log n) plus the boundaries erased
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+    reindexed(keyBegin, &keyEnd, [&] { m_map.assign(keyBegin, keyEnd, val); });
+  }
+
+  // Map [keyBegin, keyEnd) back to the value the map was constructed with
+  void reset(K const& keyBegin, K const& keyEnd) {
+    assign(keyBegin, keyEnd, m_map.default_value());
+  }
+
+  // Every run holding val, in key order, in O(number of runs)
+  std::vector<interval_run<K, V>> find_all(V const& val) const {
+    using cursor = pair_cursor<node_iterator>;
+    std::vector<interval_run<K, V>> runs;
+    auto found = m_index.find(val);
+    if (found == m_index.end())
+      return runs;
+
+    const auto& map = m_map.map();
+    runs.reserve(found->second.size());
+    for (const auto& boundary : found->second)
+      runs.push_back(run_at<K, V>(cursor(boundary.second), cursor(map.begin()), cursor(map.end())));
+    return runs;
+  }
+
+  // Map every key holding from to to instead. Each run of from is assigned
+  // in turn, merging with neighbours already holding to, so this costs
+  // O(log n) per run.
+  void replace_value(V const& from, V const& to) {
+    if (from == to)
+      return;
+
+    for (auto found = m_index.find(from); found != m_index.end(); found = m_index.find(from)) {
+      // Each assignment takes the run's boundary out of the index, and the
+      // boundary after it can't hold from as well
+      const node_iterator it = found->second.begin()->second;
+      const K keyBegin = it->first;
+      const auto next = std::next(it);
+      if (next == m_map.map().end()) {
+        reindexed(keyBegin, nullptr, [&] { m_map.assign_from(keyBegin, to); });
+      }
+      else {
+        const K keyEnd = next->first;
+        assign(keyBegin, keyEnd, to);
+      }
+    }
+  }
+
+  // Number of runs holding val
+  std::size_t count(V const& val) const {
+    auto found = m_index.find(val);
+    return found == m_index.end() ? 0 : found->second.size();
+  }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const { return m_map[key]; }
+
+  V const& default_value() const { return m_map.default_value(); }
+
+  const interval_map<K, V>& map() const { return m_map; }
+};
@@ -0,0 +1,605 @@
+#pragma once
+
+#include <map>
+#include <limits>
+#include <algorithm>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "interval_map_file.hpp"
+#include "interval_map_memory.hpp"
+#include "interval_segments.hpp"
+#include "interval_map_stats.hpp"
+#include "work_stealing_pool.hpp"
+
+template<typename K, typename V>
+class interval_map {
+  std::map<K, V> m_map;
+  // The constructor's value, which reset restores
+  V m_default;
+#ifdef INTERVAL_MAP_STATS
+  mutable interval_map_stats_recorder m_stats;
+#endif
+
+  // Assign val to [keyBegin, keyEnd) in a boundary map whose first key is no
+  // greater than keyBegin, keeping the representation canonical: no two
+  // neighbouring boundaries ever hold the same value. Returns the number of
+  // boundaries inserted (at most two).
+  static int assignRange(std::map<K, V>& map, K const& keyBegin, K const& keyEnd, V const& val) {
+    // Boundaries in [beginIt, endIt) are covered by [keyBegin, keyEnd]
+    auto beginIt = map.lower_bound(keyBegin);
+    auto endIt = map.upper_bound(keyEnd);
+
+    // Store the end value to reinsert it at the end of the range
+    const V endVal = std::prev(endIt)->second;
+
+    // Only insert boundaries that actually change the value
+    const bool insertBegin = beginIt == map.begin() || !(std::prev(beginIt)->second == val);
+    const bool insertEnd = !(endVal == val);
+
+    endIt = map.erase(beginIt, endIt);
+    if (insertEnd)
+      endIt = map.insert(endIt, std::make_pair(keyEnd, endVal));
+    if (insertBegin)
+      map.insert(endIt, std::make_pair(keyBegin, val));
+    return insertBegin + insertEnd;
+  }
+
+  // Append a boundary with a key greater than every existing key, dropping it
+  // if it doesn't change the value
+  static void appendBoundary(std::map<K, V>& map, K const& key, V const& val) {
+    if (!(std::prev(map.end())->second == val))
+      map.insert(map.end(), std::make_pair(key, val));
+  }
+
+  // Move every node of piece onto the end of m_map without reallocating it,
+  // dropping nodes that would repeat the previous value
+  void spliceBack(std::map<K, V>& piece) {
+    while (!piece.empty()) {
+      auto node = piece.extract(piece.begin());
+      if (m_map.empty() || !(std::prev(m_map.end())->second == node.mapped()))
+        m_map.insert(m_map.end(), std::move(node));
+    }
+  }
+
+  // Number of pieces to split parallel work into, enough for stealing to
+  // even out imbalanced pieces
+  static std::size_t pieceCount(std::size_t items, work_stealing_pool& pool) {
+    return std::max<std::size_t>(1, std::min<std::size_t>(items / 1024, pool.size() * 4));
+  }
+
+public:
+  // One entry of a batch of assignments, applied in order
+  struct assignment {
+    K keyBegin;
+    K keyEnd;
+    V val;
+  };
+
+  // constructor associates whole range of K with val by inserting (K_min, val)
+  // into the map
+  interval_map(V const& val) : m_default(val) {
+    m_map.insert(m_map.end(), std::make_pair(std::numeric_limits<K>::lowest(), val));
+  }
+
+  // Bulk construction from a stream of (key, value) boundaries sorted by
+  // strictly increasing key. Keys below the first boundary map to val, and
+  // boundaries that don't change the value are dropped.
+  template<typename It>
+  interval_map(V const& val, It first, It last) : m_default(val) {
+    if (first != last && !(K(std::numeric_limits<K>::lowest()) < first->first)) {
+      m_map.insert(m_map.end(), std::make_pair(first->first, first->second));
+      ++first;
+    }
+    else {
+      m_map.insert(m_map.end(), std::make_pair(std::numeric_limits<K>::lowest(), val));
+    }
+
+    for (; first != last; ++first)
+      appendBoundary(m_map, first->first, first->second);
+  }
+
+  // Parallel bulk construction from random access boundaries, as above. Each
+  // piece of the input is built into its own tree on the pool (a boundary is
+  // kept iff it differs from the boundary before it in the input, so pieces
+  // need no coordination), then the nodes are spliced together in order.
+  template<typename It>
+  interval_map(V const& val, It first, It last, work_stealing_pool& pool) : m_default(val) {
+    if (first != last && !(K(std::numeric_limits<K>::lowest()) < first->first)) {
+      m_map.insert(m_map.end(), std::make_pair(first->first, first->second));
+      ++first;
+    }
+    else {
+      m_map.insert(m_map.end(), std::make_pair(std::numeric_limits<K>::lowest(), val));
+    }
+
+    const std::size_t count = std::distance(first, last);
+    const std::size_t pieces = pieceCount(count, pool);
+    std::vector<std::map<K, V>> built(pieces);
+
+    pool.parallel_for(pieces, [&](std::size_t piece) {
+      const std::size_t pieceBegin = count * piece / pieces;
+      const std::size_t pieceEnd = count * (piece + 1) / pieces;
+      auto& map = built[piece];
+      for (std::size_t i = pieceBegin; i < pieceEnd; ++i) {
+        const auto& boundary = first[i];
+        const V& prevVal = i == 0 ? m_map.begin()->second : first[i - 1].second;
+        if (!(prevVal == boundary.second))
+          map.insert(map.end(), std::make_pair(boundary.first, boundary.second));
+      }
+    });
+
+    for (auto& piece : built)
+      spliceBack(piece);
+  }
+
+  // Assign value val to interval [keyBegin, keyEnd).
+  // Overwrite previous values in this interval.
+  // Conforming to the C++ Standard Library conventions, the interval
+  // includes keyBegin, but excludes keyEnd.
+  // If !( keyBegin < keyEnd ), this designates an empty interval,
+  // and assign must do nothing.
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+
+    // If !(keyBegin < keyEnd), assign should do nothing
+    if (!(keyBegin < keyEnd)) {
+#ifdef INTERVAL_MAP_STATS
+      m_stats.record_noop_assign();
+#endif
+      return;
+    }
+
+#ifdef INTERVAL_MAP_STATS
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t sizeBefore = m_map.size();
+    const int inserted = assignRange(m_map, keyBegin, keyEnd, val);
+    m_stats.record_assign(start, inserted, sizeBefore + inserted - m_map.size(), 2 - inserted);
+#else
+    assignRange(m_map, keyBegin, keyEnd, val);
+#endif
+  }
+
+  // Assign value val to every key from keyBegin on, which assign can't
+  // express as its intervals exclude keyEnd
+  void assign_from(K const& keyBegin, V const& val) {
+#ifdef INTERVAL_MAP_STATS
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t sizeBefore = m_map.size();
+#endif
+    auto beginIt = m_map.lower_bound(keyBegin);
+    const bool insertBegin = beginIt == m_map.begin() || !(std::prev(beginIt)->second == val);
+    m_map.erase(beginIt, m_map.end());
+    if (insertBegin)
+      m_map.insert(m_map.end(), std::make_pair(keyBegin, val));
+#ifdef INTERVAL_MAP_STATS
+    m_stats.record_assign(start, insertBegin, sizeBefore + insertBegin - m_map.size(), !insertBegin);
+#endif
+  }
+
+  // Apply a batch of assignments in order
+  template<typename It>
+  void assign_batch(It first, It last) {
+    for (; first != last; ++first)
+      assign(first->keyBegin, first->keyEnd, first->val);
+  }
+
+  // Apply a batch of assignments in order, as if by assign_batch, in parallel.
+  // The key space is split into pieces at sampled keyBegins and the
+  // assignments are sorted into per-piece buckets in one pass, clipped to
+  // the pieces and kept in order. For each piece, only the boundaries between
+  // its lowest and highest assigned keys are detached from the map, with
+  // extract, and the piece's bucket is applied to them on the pool. The
+  // nodes are then spliced back and the seams made canonical again.
+  //
+  // Detaching and splicing walks every boundary in the touched spans, so
+  // batches too small to cost more than that sequentially (count searches
+  // of the map) are applied with the sequential assign_batch instead.
+  template<typename It>
+  void assign_batch(It first, It last, work_stealing_pool& pool) {
+    const std::size_t count = std::distance(first, last);
+    const std::size_t pieces = pieceCount(count, pool);
+
+    std::size_t depth = 1;
+    for (std::size_t size = m_map.size(); size > 1; size /= 2)
+      ++depth;
+    if (pieces < 2 || count * depth < m_map.size()) {
+      assign_batch(first, last);
+      return;
+    }
+
+    // Pick piece borders from evenly spaced samples of the assigned keys
+    std::vector<K> samples;
+    const std::size_t sampleCount = std::min(count, pieces * 8);
+    for (std::size_t i = 0; i < sampleCount; ++i)
+      samples.push_back(first[count * i / sampleCount].keyBegin);
+    std::sort(samples.begin(), samples.end());
+
+    std::vector<K> borders;
+    for (std::size_t i = 1; i < pieces; ++i) {
+      const K& border = samples[samples.size() * i / pieces];
+      if ((borders.empty() || borders.back() < border) && K(std::numeric_limits<K>::lowest()) < border)
+        borders.push_back(border);
+    }
+
+    if (borders.empty()) {
+      assign_batch(first, last);
+      return;
+    }
+
+    // Each piece's assignments clipped to it, in batch order, and the span
+    // [lo, hi) of keys they cover
+    struct clipped {
+      K keyBegin;
+      K keyEnd;
+      It assignment;
+    };
+    struct piece_work {
+      std::vector<clipped> bucket;
+      std::optional<K> lo;
+      std::optional<K> hi;
+      std::map<K, V> nodes;
+    };
+    std::vector<piece_work> work(borders.size() + 1);
+    for (It assignment = first; assignment != last; ++assignment) {
+      if (!(assignment->keyBegin < assignment->keyEnd))
+        continue;
+      std::size_t piece = std::upper_bound(borders.begin(), borders.end(), assignment->keyBegin) - borders.begin();
+      for (;; ++piece) {
+        const K* pieceEnd = piece < borders.size() ? &borders[piece] : nullptr;
+        const K& keyBegin = piece > 0 && assignment->keyBegin < borders[piece - 1] ? borders[piece - 1] : assignment->keyBegin;
+        const K& keyEnd = pieceEnd && *pieceEnd < assignment->keyEnd ? *pieceEnd : assignment->keyEnd;
+        auto& w = work[piece];
+        w.bucket.push_back({ keyBegin, keyEnd, assignment });
+        if (!w.lo || keyBegin < *w.lo)
+          w.lo = keyBegin;
+        if (!w.hi || *w.hi < keyEnd)
+          w.hi = keyEnd;
+        if (!pieceEnd || !(*pieceEnd < assignment->keyEnd))
+          break;
+      }
+    }
+
+    // Pin the values at both ends of every span with a boundary, so the
+    // spans can be detached and spliced back independently. Spans of
+    // neighbouring pieces may share an end, which then belongs to the later
+    // piece.
+    auto pin = [&](const K& key) {
+      auto it = m_map.lower_bound(key);
+      if (it == m_map.end() || key < it->first)
+        m_map.insert(it, std::make_pair(key, std::prev(it)->second));
+    };
+    for (const auto& w : work) {
+      if (w.lo) {
+        pin(*w.lo);
+        pin(*w.hi);
+      }
+    }
+    for (auto& w : work) {
+      if (!w.lo)
+        continue;
+      for (auto it = m_map.lower_bound(*w.lo); it->first < *w.hi;) {
+        auto next = std::next(it);
+        w.nodes.insert(w.nodes.end(), m_map.extract(it));
+        it = next;
+      }
+    }
+
+    pool.parallel_for(work.size(), [&](std::size_t piece) {
+      auto& w = work[piece];
+      for (const auto& c : w.bucket)
+        assignRange(w.nodes, c.keyBegin, c.keyEnd, c.assignment->val);
+      // The pinned boundary at hi, still in the map, holds the value from
+      // there on
+      if (w.lo)
+        w.nodes.erase(w.nodes.lower_bound(*w.hi), w.nodes.end());
+    });
+
+    // Splice the nodes back in front of the boundary at hi, then drop
+    // boundaries at the seams that repeat the value before them
+    auto dropRepeat = [&](const K& key) {
+      auto it = m_map.find(key);
+      if (it != m_map.end() && it != m_map.begin() && std::prev(it)->second == it->second)
+        m_map.erase(it);
+    };
+    for (auto& w : work) {
+      if (!w.lo)
+        continue;
+      const auto hint = m_map.lower_bound(*w.hi);
+      while (!w.nodes.empty())
+        m_map.insert(hint, w.nodes.extract(w.nodes.begin()));
+    }
+    for (const auto& w : work) {
+      if (w.lo) {
+        dropRepeat(*w.lo);
+        dropRepeat(*w.hi);
+      }
+    }
+  }
+
+  // Set the value of every key in [keyBegin, keyEnd) to f(value). Splits
+  // only at keyBegin and keyEnd, then walks the boundaries in between once,
+  // replacing each value with f of it and erasing boundaries that end up
+  // equal to their predecessor, so this costs O(log n + k) for k boundaries
+  // in the range and leaves the map canonical.
+  template<typename F>
+  void update(K const& keyBegin, K const& keyEnd, F f) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    // Boundaries at both ends keep the values outside the range as they are
+    auto last = m_map.lower_bound(keyEnd);
+    if (last == m_map.end() || keyEnd < last->first)
+      last = m_map.insert(last, std::make_pair(keyEnd, std::prev(last)->second));
+    auto first = m_map.lower_bound(keyBegin);
+    if (keyBegin < first->first)
+      first = m_map.insert(first, std::make_pair(keyBegin, std::prev(first)->second));
+
+    for (auto it = first; it != last;) {
+      it->second = f(it->second);
+      if (it != m_map.begin() && it->second == std::prev(it)->second)
+        it = m_map.erase(it);
+      else
+        ++it;
+    }
+    if (last->second == std::prev(last)->second)
+      m_map.erase(last);
+  }
+
+  // Combine other into this map pointwise, setting the value of every key k
+  // to f((*this)[k], other[k]). Both boundary sequences are walked together
+  // in O(n + m): this map's nodes are updated in place, other's boundaries
+  // are inserted with a hint and boundaries left holding their predecessor's
+  // value are erased, so the result is canonical.
+  template<typename B, typename F>
+  void combine(const interval_map<K, B>& other, F f) {
+    const auto& otherMap = other.map();
+    auto it = m_map.begin();
+    auto otherIt = otherMap.begin();
+
+    // Both maps start with a boundary at the lowest key
+    V val = it->second;
+    const B* otherVal = &otherIt->second;
+    it->second = f(val, *otherVal);
+    m_default = f(m_default, other.default_value());
+    auto last = it;
+    ++it;
+    ++otherIt;
+
+    while (it != m_map.end() || otherIt != otherMap.end()) {
+      // Which maps change at the next key
+      const bool atThis = it != m_map.end() && (otherIt == otherMap.end() || !(otherIt->first < it->first));
+      const bool atOther = otherIt != otherMap.end() && (it == m_map.end() || !(it->first < otherIt->first));
+      if (atOther)
+        otherVal = &otherIt->second;
+
+      if (atThis) {
+        // Update the boundary, or drop it if it no longer changes the value
+        val = it->second;
+        V combined = f(val, *otherVal);
+        if (combined == last->second) {
+          it = m_map.erase(it);
+        }
+        else {
+          it->second = std::move(combined);
+          last = it++;
+        }
+      }
+      else {
+        V combined = f(val, *otherVal);
+        if (!(combined == last->second))
+          last = m_map.insert(it, std::make_pair(otherIt->first, std::move(combined)));
+      }
+
+      if (atOther)
+        ++otherIt;
+    }
+  }
+
+  // Map [keyBegin, keyEnd) back to the value the map was constructed with.
+  // A range holding at most half the boundaries is erased as assign would.
+  // A larger one is dropped wholesale: the boundaries outside it move to a
+  // new tree, and the old tree, left holding only the range, is torn down
+  // in one pass without rebalancing after every node. Either way the tree
+  // only rebalances for the smaller side, and this takes O(log n + k) for k
+  // boundaries in the range.
+  void reset(K const& keyBegin, K const& keyEnd) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    const auto beginIt = m_map.lower_bound(keyBegin);
+    const auto endIt = m_map.upper_bound(keyEnd);
+    const std::size_t half = m_map.size() / 2;
+    std::size_t inside = 0;
+    for (auto it = beginIt; it != endIt && inside <= half; ++it)
+      ++inside;
+    if (inside <= half) {
+      assign(keyBegin, keyEnd, m_default);
+      return;
+    }
+
+#ifdef INTERVAL_MAP_STATS
+    const auto start = std::chrono::steady_clock::now();
+    const std::size_t sizeBefore = m_map.size();
+#endif
+    const V endVal = std::prev(endIt)->second;
+    const bool insertBegin = beginIt == m_map.begin() || !(std::prev(beginIt)->second == m_default);
+    const bool insertEnd = !(endVal == m_default);
+
+    std::map<K, V> kept;
+    for (auto it = m_map.begin(); it != beginIt;)
+      kept.insert(kept.end(), m_map.extract(it++));
+    if (insertBegin)
+      kept.insert(kept.end(), std::make_pair(keyBegin, m_default));
+    if (insertEnd)
+      kept.insert(kept.end(), std::make_pair(keyEnd, endVal));
+    for (auto it = endIt; it != m_map.end();)
+      kept.insert(kept.end(), m_map.extract(it++));
+    m_map.swap(kept);
+#ifdef INTERVAL_MAP_STATS
+    const int inserted = insertBegin + insertEnd;
+    m_stats.record_assign(start, inserted, sizeBefore + inserted - m_map.size(), 2 - inserted);
+#endif
+  }
+
+  // Map every key back to the value the map was constructed with
+  void reset() {
+    m_map.clear();
+    m_map.insert(m_map.end(), std::make_pair(std::numeric_limits<K>::lowest(), m_default));
+  }
+
+  V const& default_value() const { return m_default; }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const {
+#ifdef INTERVAL_MAP_STATS
+    const auto start = std::chrono::steady_clock::now();
+    V const& val = (--m_map.upper_bound(key))->second;
+    m_stats.record_lookup(start);
+    return val;
+#else
+    return (--m_map.upper_bound(key))->second;
+#endif
+  }
+
+  // Look up every key in [first, last) on the pool, writing the value for
+  // first[i] to out[i]. Keys are split into contiguous pieces so each worker
+  // reads and writes its own blocks of memory. With sortChunks, each piece is
+  // visited in key order and walked with a cursor instead of searching from
+  // the root for every key, which pays off when keys are dense relative to
+  // the boundaries. The map must not be modified during the call.
+  template<typename KeyIt, typename OutIt>
+  void parallel_lookup(KeyIt first, KeyIt last, OutIt out, work_stealing_pool& pool, bool sortChunks = false) const {
+    const std::size_t count = std::distance(first, last);
+    const std::size_t pieces = pieceCount(count, pool);
+
+    pool.parallel_for(pieces, [&](std::size_t piece) {
+      const std::size_t pieceBegin = count * piece / pieces;
+      const std::size_t pieceEnd = count * (piece + 1) / pieces;
+
+      if (!sortChunks) {
+        for (std::size_t i = pieceBegin; i < pieceEnd; ++i)
+          out[i] = (*this)[first[i]];
+        return;
+      }
+
+      std::vector<std::size_t> order(pieceEnd - pieceBegin);
+      for (std::size_t i = 0; i < order.size(); ++i)
+        order[i] = pieceBegin + i;
+      std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+        return first[a] < first[b];
+      });
+
+      // Step the cursor forward a few boundaries at a time, and fall back to
+      // a search when the next key is further away than that
+      auto cursor = m_map.begin();
+      for (std::size_t i : order) {
+        const K& key = first[i];
+        auto next = std::next(cursor);
+        int steps = 0;
+        while (next != m_map.end() && !(key < next->first)) {
+          if (++steps > 8) {
+            next = m_map.upper_bound(key);
+            break;
+          }
+          ++next;
+        }
+        cursor = std::prev(next);
+        out[i] = cursor->second;
+      }
+    });
+  }
+
+  // Write the boundaries to path in the format read by mapped_interval_map,
+  // replacing any existing file atomically and durably. Requires trivially
+  // copyable K and V; throws std::system_error or
+  // std::filesystem::filesystem_error on failure.
+  void save(const std::string& path) const {
+    interval_map_file::write<K, V>(path, m_map.begin(), m_map.size());
+  }
+
+  // The segments of [lo, hi), clipped to it, in key order (or reverse order
+  // through rbegin and rend). Values are referenced, not copied.
+  segment_view<K, V, pair_cursor<typename std::map<K, V>::const_iterator>> segments(K const& lo, K const& hi) const {
+    using cursor = pair_cursor<typename std::map<K, V>::const_iterator>;
+    if (!(lo < hi))
+      return { cursor(m_map.end()), cursor(m_map.end()), lo, hi };
+    return { cursor(std::prev(m_map.upper_bound(lo))), cursor(m_map.lower_bound(hi)), lo, hi };
+  }
+
+  // The run of a single value holding key, found with one search
+  interval_run<K, V> segment_containing(K const& key) const {
+    using cursor = pair_cursor<typename std::map<K, V>::const_iterator>;
+    return run_at<K, V>(cursor(std::prev(m_map.upper_bound(key))), cursor(m_map.begin()), cursor(m_map.end()));
+  }
+
+  // The run after the one holding key, which starts where the value next
+  // changes, or nothing if key is in the last run
+  std::optional<interval_run<K, V>> next_change(K const& key) const {
+    using cursor = pair_cursor<typename std::map<K, V>::const_iterator>;
+    auto it = m_map.upper_bound(key);
+    if (it == m_map.end())
+      return std::nullopt;
+    return run_at<K, V>(cursor(it), cursor(m_map.begin()), cursor(m_map.end()));
+  }
+
+  // The run before the one holding key, or nothing if key is in the first run
+  std::optional<interval_run<K, V>> prev_change(K const& key) const {
+    using cursor = pair_cursor<typename std::map<K, V>::const_iterator>;
+    auto it = std::prev(m_map.upper_bound(key));
+    if (it == m_map.begin())
+      return std::nullopt;
+    return run_at<K, V>(cursor(std::prev(it)), cursor(m_map.begin()), cursor(m_map.end()));
+  }
+
+  // Estimated memory held by the boundaries. std::map allocates a node per
+  // boundary holding the key and value and the tree links, which are modelled
+  // on the usual red-black tree node (a colour and three pointers).
+  interval_map_memory memory_usage() const {
+    struct node {
+      int colour;
+      void* links[3];
+      std::pair<const K, V> value;
+    };
+
+    interval_map_memory usage;
+    const std::size_t count = m_map.size();
+    usage.values = count * sizeof(std::pair<const K, V>);
+    usage.nodes = count * (sizeof(node) - sizeof(std::pair<const K, V>));
+    usage.overhead = count * (interval_map_memory::heap_block(sizeof(node)) - sizeof(node));
+    return usage;
+  }
+
+#ifdef INTERVAL_MAP_STATS
+  // Counters and latency histograms of assign and operator[], including
+  // assign_from, reset and the paths built on them: the sequential
+  // assign_batch and the unsorted parallel_lookup. The parallel assign_batch,
+  // update and combine rewrite many boundaries at once and aren't counted.
+  interval_map_stats stats() const { return m_stats.snapshot(); }
+  void reset_stats() { m_stats.reset(); }
+#endif
+
+  // little backdoor for verifying canonical representation in tests
+  const std::map<K, V>& map() const { return m_map; }
+};
+
+// The pointwise combination of a and b: every key k maps to f(a[k], b[k]).
+// Both boundary sequences are swept together and the result is built with
+// the linear bulk constructor, so this takes O(n + m) and is canonical.
+template<typename K, typename A, typename B, typename F>
+auto combine(const interval_map<K, A>& a, const interval_map<K, B>& b, F f) {
+  using R = std::decay_t<decltype(f(std::declval<A const&>(), std::declval<B const&>()))>;
+  using cursorA = pair_cursor<typename std::map<K, A>::const_iterator>;
+  using cursorB = pair_cursor<typename std::map<K, B>::const_iterator>;
+
+  std::vector<std::pair<K, R>> boundaries;
+  boundaries.reserve(a.map().size() + b.map().size());
+  sweep_boundaries(cursorA(a.map().begin()), cursorA(a.map().end()), cursorB(b.map().begin()), cursorB(b.map().end()),
+    [&](const K* key, A const& aVal, B const& bVal) {
+      boundaries.emplace_back(key ? *key : K(std::numeric_limits<K>::lowest()), f(aVal, bVal));
+    });
+  return interval_map<K, R>(f(a.default_value(), b.default_value()), boundaries.begin(), boundaries.end());
+}
@@ -0,0 +1,226 @@
+#pragma once
+
+#include <atomic>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+
+#ifdef _WIN32
+#include <io.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+// On-disk layout shared by interval_map::save and mapped_interval_map:
+//
+//   file_header                 (checksummed, fixed size)
+//   K keys[count]               (at keysOffset, 64 byte aligned)
+//   V vals[count]               (at valsOffset, 64 byte aligned)
+//
+// Keys and values are stored in native representation, so the file can be
+// searched in place once mapped. The header records the type sizes and byte
+// order so a file written by an incompatible build is rejected.
+namespace interval_map_file {
+
+  constexpr char magic[8] = { 'I', 'N', 'T', 'V', 'M', 'A', 'P', '\0' };
+  constexpr std::uint32_t version = 1;
+  constexpr std::uint32_t byteOrderTag = 0x01020304;
+  constexpr std::uint64_t alignment = 64;
+
+  struct file_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrderTag;
+    std::uint32_t keySize;
+    std::uint32_t valSize;
+    std::uint64_t count;
+    std::uint64_t keysOffset;
+    std::uint64_t valsOffset;
+    std::uint64_t fileSize;
+    std::uint64_t payloadChecksum;
+    std::uint64_t headerChecksum;
+  };
+
+  constexpr std::uint64_t checksumSeed = 14695981039346656037ull;
+
+  // 64-bit FNV-1a, continuing from hash
+  inline std::uint64_t checksum(const void* data, std::size_t size, std::uint64_t hash = checksumSeed) {
+    const unsigned char* bytes = static_cast<const unsigned char*>(data);
+    for (std::size_t i = 0; i < size; ++i) {
+      hash ^= bytes[i];
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  inline std::uint64_t alignUp(std::uint64_t offset) {
+    return (offset + alignment - 1) / alignment * alignment;
+  }
+
+  // Write size bytes to file, throwing std::system_error on failure
+  inline void writeBytes(std::FILE* file, const void* data, std::size_t size, const std::string& path) {
+    if (std::fwrite(data, 1, size, file) != size)
+      throw std::system_error(errno, std::generic_category(), "failed writing " + path);
+  }
+
+  inline void writePadding(std::FILE* file, std::uint64_t size, const std::string& path) {
+    const char zeros[alignment] = {};
+    for (; size > alignment; size -= alignment)
+      writeBytes(file, zeros, alignment, path);
+    writeBytes(file, zeros, size, path);
+  }
+
+  // Flush file's buffers and wait until its contents are on stable storage
+  inline void syncFile(std::FILE* file, const std::string& path) {
+    if (std::fflush(file) != 0)
+      throw std::system_error(errno, std::generic_category(), "failed writing " + path);
+#ifdef _WIN32
+    if (_commit(_fileno(file)) != 0)
+#else
+    if (::fsync(fileno(file)) != 0)
+#endif
+      throw std::system_error(errno, std::generic_category(), "failed syncing " + path);
+  }
+
+  // Make creations, renames and removals of files in directory durable. Windows
+  // has no equivalent, as its directory updates are journaled.
+  inline void syncDirectory(const std::filesystem::path& directory) {
+#ifndef _WIN32
+    const std::string path = directory.empty() ? std::string(".") : directory.string();
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "can't open " + path);
+    const int result = ::fsync(fd);
+    const int error = errno;
+    ::close(fd);
+    if (result != 0)
+      throw std::system_error(error, std::generic_category(), "failed syncing " + path);
+#else
+    (void)directory;
+#endif
+  }
+
+  inline std::uint64_t headerChecksum(const file_header& header) {
+    return checksum(&header, offsetof(file_header, headerChecksum));
+  }
+
+  template<typename K, typename V>
+  file_header makeHeader(std::uint64_t count) {
+    file_header header{};
+    std::memcpy(header.magic, magic, sizeof(magic));
+    header.version = version;
+    header.byteOrderTag = byteOrderTag;
+    header.keySize = sizeof(K);
+    header.valSize = sizeof(V);
+    header.count = count;
+    header.keysOffset = alignUp(sizeof(file_header));
+    header.valsOffset = alignUp(header.keysOffset + count * sizeof(K));
+    header.fileSize = header.valsOffset + count * sizeof(V);
+    return header;
+  }
+
+  // Check a header read from a file of fileSize bytes, throwing
+  // std::runtime_error describing the first problem found
+  template<typename K, typename V>
+  void validateHeader(const file_header& header, std::uint64_t fileSize) {
+    if (std::memcmp(header.magic, magic, sizeof(magic)) != 0)
+      throw std::runtime_error("not an interval_map file");
+    if (header.headerChecksum != headerChecksum(header))
+      throw std::runtime_error("interval_map file header is corrupt");
+    if (header.version != version)
+      throw std::runtime_error("unsupported interval_map file version " + std::to_string(header.version));
+    if (header.byteOrderTag != byteOrderTag || header.keySize != sizeof(K) || header.valSize != sizeof(V))
+      throw std::runtime_error("interval_map file was written for different key or value types");
+
+    const file_header expected = makeHeader<K, V>(header.count);
+    if (header.count == 0 || header.keysOffset != expected.keysOffset || header.valsOffset != expected.valsOffset
+        || header.fileSize != expected.fileSize || header.fileSize != fileSize)
+      throw std::runtime_error("interval_map file layout is inconsistent");
+  }
+
+  // A temporary name next to path that no other save, from this process or
+  // another, is writing to
+  inline std::string tempPath(const std::string& path) {
+    static std::atomic<std::uint64_t> counter{ 0 };
+#ifdef _WIN32
+    const auto pid = _getpid();
+#else
+    const auto pid = getpid();
+#endif
+    return path + ".tmp." + std::to_string(pid) + "." + std::to_string(counter.fetch_add(1, std::memory_order_relaxed));
+  }
+
+  // Write count boundaries from [first, first + count) to path. The file is
+  // written and synced next to path under a name of its own, then renamed
+  // over it, so readers never see a partial file, a crash leaves either the
+  // old or the new one, and concurrent saves to path each rename a whole
+  // file.
+  template<typename K, typename V, typename It>
+  void write(const std::string& path, It first, std::uint64_t count) {
+    static_assert(std::is_trivially_copyable<K>::value, "K must be trivially copyable to be saved");
+    static_assert(std::is_trivially_copyable<V>::value, "V must be trivially copyable to be saved");
+
+    file_header header = makeHeader<K, V>(count);
+    const std::string tmpPath = tempPath(path);
+    std::FILE* file = std::fopen(tmpPath.c_str(), "wb");
+    if (!file)
+      throw std::system_error(errno, std::generic_category(), "can't open " + tmpPath + " for writing");
+
+    try {
+      // Header goes in last, once the payload checksum is known
+      writePadding(file, header.keysOffset, tmpPath);
+
+      std::uint64_t hash = checksumSeed;
+      It it = first;
+      for (std::uint64_t i = 0; i < count; ++i, ++it) {
+        const K key = it->first;
+        hash = checksum(&key, sizeof(K), hash);
+        writeBytes(file, &key, sizeof(K), tmpPath);
+      }
+      writePadding(file, header.valsOffset - (header.keysOffset + count * sizeof(K)), tmpPath);
+
+      it = first;
+      for (std::uint64_t i = 0; i < count; ++i, ++it) {
+        const V val = it->second;
+        hash = checksum(&val, sizeof(V), hash);
+        writeBytes(file, &val, sizeof(V), tmpPath);
+      }
+
+      header.payloadChecksum = hash;
+      header.headerChecksum = headerChecksum(header);
+      if (std::fseek(file, 0, SEEK_SET) != 0)
+        throw std::system_error(errno, std::generic_category(), "failed writing " + tmpPath);
+      writeBytes(file, &header, sizeof(header), tmpPath);
+      syncFile(file, tmpPath);
+    }
+    catch (...) {
+      std::fclose(file);
+      std::remove(tmpPath.c_str());
+      throw;
+    }
+
+    if (std::fclose(file) != 0) {
+      const int error = errno;
+      std::remove(tmpPath.c_str());
+      throw std::system_error(error, std::generic_category(), "failed writing " + tmpPath);
+    }
+    try {
+      std::filesystem::rename(tmpPath, path);
+    }
+    catch (...) {
+      std::remove(tmpPath.c_str());
+      throw;
+    }
+    syncDirectory(std::filesystem::path(path).parent_path());
+  }
+
+}
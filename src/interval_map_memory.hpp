@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+
+// Bytes used by an interval map, as reported by memory_usage(). Memory that
+// values own themselves (a std::string's buffer, say) isn't included, nor is
+// the map object itself.
+struct interval_map_memory {
+  // Per-boundary bookkeeping, such as tree links
+  std::size_t nodes = 0;
+  // Stored keys and values
+  std::size_t values = 0;
+  // Estimated allocator headers and rounding, or file headers for maps
+  // backed by a file
+  std::size_t overhead = 0;
+  // Allocated or mapped but unused, as in spare vector capacity
+  std::size_t slack = 0;
+
+  std::size_t total() const { return nodes + values + overhead + slack; }
+
+  // Estimated bytes a general purpose allocator takes for a block of size
+  // bytes: an 8 byte header, rounded up to 16 bytes, with a 32 byte minimum.
+  // That's what glibc's malloc does on 64 bit platforms; others are similar.
+  static std::size_t heap_block(std::size_t size) {
+    const std::size_t block = (size + sizeof(void*) + 15) / 16 * 16;
+    return block < 32 ? 32 : block;
+  }
+};
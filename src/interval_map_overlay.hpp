@@ -0,0 +1,78 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <queue>
+#include <set>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "interval_map.hpp"
+
+// Overlay the interval_maps in [first, last), later maps taking priority over
+// earlier ones, so the result is what assigning every segment of every layer
+// in order would build. With skipDefaults, the regions where a layer holds
+// its default_value() are transparent and the layers below show through; the
+// first layer is always opaque, so its default is the result's default.
+//
+// All layers' boundaries are swept together with a heap of the next boundary
+// of each layer, and the topmost opaque layer is tracked in an ordered set,
+// so this takes O(total boundaries * log layers). Throws
+// std::invalid_argument if there are no layers.
+template<typename It>
+auto overlay(It first, It last, bool skipDefaults = true) {
+  using map_type = typename std::iterator_traits<It>::value_type;
+  using K = typename std::decay_t<decltype(first->map())>::key_type;
+  using V = typename std::decay_t<decltype(first->map())>::mapped_type;
+  using node_iterator = typename std::map<K, V>::const_iterator;
+
+  std::vector<const map_type*> layers;
+  for (; first != last; ++first)
+    layers.push_back(&*first);
+  if (layers.empty())
+    throw std::invalid_argument("overlay needs at least one layer");
+
+  // Next boundary of each layer, and a min-heap of layers by that boundary
+  std::vector<node_iterator> next(layers.size());
+  auto later = [&](std::size_t a, std::size_t b) { return next[b]->first < next[a]->first; };
+  std::priority_queue<std::size_t, std::vector<std::size_t>, decltype(later)> heap(later);
+
+  // Layers whose current value hides the layers below them
+  std::set<std::size_t> opaque;
+  std::vector<const V*> current(layers.size());
+  auto setCurrent = [&](std::size_t layer, const V& val) {
+    current[layer] = &val;
+    if (layer == 0 || !skipDefaults || !(val == layers[layer]->default_value()))
+      opaque.insert(layer);
+    else
+      opaque.erase(layer);
+  };
+
+  // Every layer starts with a boundary at the lowest key
+  for (std::size_t layer = 0; layer < layers.size(); ++layer) {
+    const auto& map = layers[layer]->map();
+    setCurrent(layer, map.begin()->second);
+    next[layer] = std::next(map.begin());
+    if (next[layer] != map.end())
+      heap.push(layer);
+  }
+
+  std::vector<std::pair<K, V>> boundaries;
+  boundaries.emplace_back(std::numeric_limits<K>::lowest(), *current[*opaque.rbegin()]);
+  while (!heap.empty()) {
+    // Apply every layer's boundary at the next key before emitting it
+    const K key = next[heap.top()]->first;
+    while (!heap.empty() && !(key < next[heap.top()]->first)) {
+      const std::size_t layer = heap.top();
+      heap.pop();
+      setCurrent(layer, next[layer]->second);
+      if (++next[layer] != layers[layer]->map().end())
+        heap.push(layer);
+    }
+    boundaries.emplace_back(key, *current[*opaque.rbegin()]);
+  }
+
+  return map_type(layers.front()->default_value(), boundaries.begin(), boundaries.end());
+}
@@ -0,0 +1,150 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+// Operation counters and latency histograms for interval_map. They are only
+// collected when INTERVAL_MAP_STATS is defined (cmake -DINTERVAL_MAP_STATS=ON);
+// otherwise interval_map has no stats members and its operations aren't timed.
+
+// Latencies bucketed by powers of two: bucket i counts operations that took
+// [2^i, 2^(i+1)) nanoseconds, bucket 0 also counts anything faster and the
+// last bucket anything slower
+struct latency_histogram {
+  static constexpr std::size_t bucket_count = 40;
+  std::array<std::uint64_t, bucket_count> buckets{};
+
+  static std::size_t bucket(std::uint64_t ns) {
+    std::size_t i = 0;
+    while (ns >>= 1)
+      ++i;
+    return i < bucket_count ? i : bucket_count - 1;
+  }
+
+  std::uint64_t count() const {
+    std::uint64_t total = 0;
+    for (std::uint64_t n : buckets)
+      total += n;
+    return total;
+  }
+
+  // Upper bound in nanoseconds of the bucket holding quantile q (0 to 1) of
+  // the operations, or 0 if none were recorded
+  std::uint64_t quantile(double q) const {
+    const std::uint64_t total = count();
+    if (total == 0)
+      return 0;
+
+    const std::uint64_t rank = static_cast<std::uint64_t>(q * double(total - 1));
+    std::uint64_t seen = 0;
+    for (std::size_t i = 0; i < bucket_count; ++i) {
+      seen += buckets[i];
+      if (seen > rank)
+        return std::uint64_t(1) << (i + 1);
+    }
+    return std::uint64_t(1) << bucket_count;
+  }
+};
+
+// Snapshot of the stats of one interval_map
+struct interval_map_stats {
+  std::uint64_t assigns = 0;
+  // Assigns of an empty interval, which change nothing
+  std::uint64_t noopAssigns = 0;
+  std::uint64_t insertedBoundaries = 0;
+  std::uint64_t erasedBoundaries = 0;
+  // Boundaries an assign didn't insert because the neighbouring interval
+  // already held the same value
+  std::uint64_t coalescedBoundaries = 0;
+  std::uint64_t lookups = 0;
+  latency_histogram assignLatency;
+  latency_histogram lookupLatency;
+};
+
+// Thread-safe accumulator behind interval_map::stats(). Lookups may run
+// concurrently, so everything is a relaxed atomic.
+class interval_map_stats_recorder {
+  using counter = std::atomic<std::uint64_t>;
+
+  counter m_assigns{ 0 };
+  counter m_noopAssigns{ 0 };
+  counter m_insertedBoundaries{ 0 };
+  counter m_erasedBoundaries{ 0 };
+  counter m_coalescedBoundaries{ 0 };
+  counter m_lookups{ 0 };
+  std::array<counter, latency_histogram::bucket_count> m_assignLatency{};
+  std::array<counter, latency_histogram::bucket_count> m_lookupLatency{};
+
+  static void add(counter& c, std::uint64_t n) {
+    c.fetch_add(n, std::memory_order_relaxed);
+  }
+
+  static std::uint64_t elapsedNs(std::chrono::steady_clock::time_point start) {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+  }
+
+  void copyFrom(const interval_map_stats_recorder& other) {
+    const interval_map_stats stats = other.snapshot();
+    m_assigns.store(stats.assigns, std::memory_order_relaxed);
+    m_noopAssigns.store(stats.noopAssigns, std::memory_order_relaxed);
+    m_insertedBoundaries.store(stats.insertedBoundaries, std::memory_order_relaxed);
+    m_erasedBoundaries.store(stats.erasedBoundaries, std::memory_order_relaxed);
+    m_coalescedBoundaries.store(stats.coalescedBoundaries, std::memory_order_relaxed);
+    m_lookups.store(stats.lookups, std::memory_order_relaxed);
+    for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i) {
+      m_assignLatency[i].store(stats.assignLatency.buckets[i], std::memory_order_relaxed);
+      m_lookupLatency[i].store(stats.lookupLatency.buckets[i], std::memory_order_relaxed);
+    }
+  }
+
+public:
+  interval_map_stats_recorder() = default;
+  interval_map_stats_recorder(const interval_map_stats_recorder& other) { copyFrom(other); }
+  interval_map_stats_recorder& operator=(const interval_map_stats_recorder& other) {
+    copyFrom(other);
+    return *this;
+  }
+
+  void record_noop_assign() {
+    add(m_assigns, 1);
+    add(m_noopAssigns, 1);
+  }
+
+  void record_assign(std::chrono::steady_clock::time_point start, std::uint64_t inserted, std::uint64_t erased,
+      std::uint64_t coalesced) {
+    add(m_assignLatency[latency_histogram::bucket(elapsedNs(start))], 1);
+    add(m_assigns, 1);
+    add(m_insertedBoundaries, inserted);
+    add(m_erasedBoundaries, erased);
+    add(m_coalescedBoundaries, coalesced);
+  }
+
+  void record_lookup(std::chrono::steady_clock::time_point start) {
+    add(m_lookupLatency[latency_histogram::bucket(elapsedNs(start))], 1);
+    add(m_lookups, 1);
+  }
+
+  // Counters are read one by one, so a snapshot taken while other threads
+  // are recording may be off by those operations
+  interval_map_stats snapshot() const {
+    interval_map_stats stats;
+    stats.assigns = m_assigns.load(std::memory_order_relaxed);
+    stats.noopAssigns = m_noopAssigns.load(std::memory_order_relaxed);
+    stats.insertedBoundaries = m_insertedBoundaries.load(std::memory_order_relaxed);
+    stats.erasedBoundaries = m_erasedBoundaries.load(std::memory_order_relaxed);
+    stats.coalescedBoundaries = m_coalescedBoundaries.load(std::memory_order_relaxed);
+    stats.lookups = m_lookups.load(std::memory_order_relaxed);
+    for (std::size_t i = 0; i < latency_histogram::bucket_count; ++i) {
+      stats.assignLatency.buckets[i] = m_assignLatency[i].load(std::memory_order_relaxed);
+      stats.lookupLatency.buckets[i] = m_lookupLatency[i].load(std::memory_order_relaxed);
+    }
+    return stats;
+  }
+
+  void reset() {
+    copyFrom(interval_map_stats_recorder());
+  }
+};
@@ -0,0 +1,309 @@
+#pragma once
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <memory>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "interval_map.hpp"
+#include "interval_map_file.hpp"
+
+// Binary traces of the operations made on an interval_map, so a workload can
+// be reproduced exactly without the data behind it. A trace is a header
+// holding the map's initial value followed by one record per operation:
+//
+//   assign: op_assign, K keyBegin, K keyEnd, V val
+//   lookup: op_lookup, K key
+namespace interval_map_trace {
+
+  constexpr char magic[8] = { 'I', 'N', 'T', 'V', 'T', 'R', 'C', '\0' };
+  constexpr std::uint32_t version = 1;
+  constexpr unsigned char op_assign = 0;
+  constexpr unsigned char op_lookup = 1;
+
+  struct file_header {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t keySize;
+    std::uint32_t valSize;
+    std::uint32_t anonymized;
+  };
+
+  template<typename K, typename V>
+  struct record {
+    unsigned char op;
+    K keyBegin;
+    K keyEnd;
+    V val;
+  };
+
+  struct file_closer {
+    void operator()(std::FILE* file) const { std::fclose(file); }
+  };
+
+  // Appends records to a trace file, buffering them in memory. With
+  // anonymizeKeys, every key is shifted by a secret random offset, which
+  // keeps the order of and distances between keys, and so the shape of the
+  // workload. The offset is picked when the first key is recorded, so that
+  // key lands in the middle half of the key range at random, and records are
+  // written out as they come. Keys at least a quarter of the key range away
+  // from the first one may be shifted past an end of the range; those are
+  // clamped to that end instead of wrapping around, which keeps their order
+  // but not their distances, and are counted by clamped().
+  template<typename K, typename V>
+  class writer {
+    static_assert(std::is_trivially_copyable<K>::value, "K must be trivially copyable to be traced");
+    static_assert(std::is_trivially_copyable<V>::value, "V must be trivially copyable to be traced");
+
+    // Keys are shifted as their unsigned distance from the lowest key
+    using distance_type = std::make_unsigned_t<std::conditional_t<std::is_integral<K>::value, K, int>>;
+
+    std::string m_path;
+    std::unique_ptr<std::FILE, file_closer> m_file;
+    std::vector<char> m_buffer;
+    bool m_anonymize;
+    // The offset, as a magnitude and direction, once the first key is seen
+    bool m_offsetPicked = false;
+    bool m_offsetDown = false;
+    distance_type m_offset = 0;
+    std::uint64_t m_clamped = 0;
+
+    static distance_type distance(K const& key) {
+      return static_cast<distance_type>(static_cast<distance_type>(key) - static_cast<distance_type>(std::numeric_limits<K>::lowest()));
+    }
+
+    static K fromDistance(distance_type d) {
+      return static_cast<K>(static_cast<distance_type>(static_cast<distance_type>(std::numeric_limits<K>::lowest()) + d));
+    }
+
+    void pickOffset(K const& first) {
+      constexpr distance_type top = std::numeric_limits<distance_type>::max();
+      std::mt19937_64 random(std::random_device{}());
+      const distance_type target = static_cast<distance_type>(
+        std::uniform_int_distribution<std::uint64_t>(top / 4, top - top / 4)(random));
+      const distance_type from = distance(first);
+      m_offsetDown = target < from;
+      m_offset = m_offsetDown ? from - target : target - from;
+      m_offsetPicked = true;
+    }
+
+    K shifted(K const& key) {
+      if (!m_offsetPicked)
+        pickOffset(key);
+      const distance_type d = distance(key);
+      if (m_offsetDown) {
+        if (d < m_offset) {
+          ++m_clamped;
+          return std::numeric_limits<K>::lowest();
+        }
+        return fromDistance(d - m_offset);
+      }
+      if (std::numeric_limits<distance_type>::max() - d < m_offset) {
+        ++m_clamped;
+        return std::numeric_limits<K>::max();
+      }
+      return fromDistance(d + m_offset);
+    }
+
+    template<typename T>
+    void put(const T& value) {
+      const char* bytes = reinterpret_cast<const char*>(&value);
+      m_buffer.insert(m_buffer.end(), bytes, bytes + sizeof(T));
+      if (m_buffer.size() >= (1 << 16))
+        flush();
+    }
+
+    void putAssign(K const& keyBegin, K const& keyEnd, V const& val) {
+      put(op_assign);
+      put(keyBegin);
+      put(keyEnd);
+      put(val);
+    }
+
+    void putLookup(K const& key) {
+      put(op_lookup);
+      put(key);
+    }
+
+  public:
+    writer(const std::string& path, V const& initialVal, bool anonymizeKeys = false)
+      : m_path(path), m_file(std::fopen(path.c_str(), "wb")), m_anonymize(anonymizeKeys) {
+      if (!m_file)
+        throw std::system_error(errno, std::generic_category(), "can't open " + path + " for writing");
+      if (anonymizeKeys && !std::is_integral<K>::value)
+        throw std::invalid_argument("key anonymization needs integral keys");
+
+      file_header header{};
+      std::memcpy(header.magic, magic, sizeof(magic));
+      header.version = version;
+      header.keySize = sizeof(K);
+      header.valSize = sizeof(V);
+      header.anonymized = anonymizeKeys;
+      put(header);
+      put(initialVal);
+    }
+
+    ~writer() {
+      try {
+        close();
+      }
+      catch (...) {
+      }
+    }
+
+    void record_assign(K const& keyBegin, K const& keyEnd, V const& val) {
+      if (m_anonymize)
+        putAssign(shifted(keyBegin), shifted(keyEnd), val);
+      else
+        putAssign(keyBegin, keyEnd, val);
+    }
+
+    void record_lookup(K const& key) {
+      putLookup(m_anonymize ? shifted(key) : key);
+    }
+
+    // Anonymized keys clamped to an end of the key range so far
+    std::uint64_t clamped() const { return m_clamped; }
+
+    void flush() {
+      interval_map_file::writeBytes(m_file.get(), m_buffer.data(), m_buffer.size(), m_path);
+      if (std::fflush(m_file.get()) != 0)
+        throw std::system_error(errno, std::generic_category(), "failed writing " + m_path);
+      m_buffer.clear();
+    }
+
+    // Write out buffered records and close the file. The destructor does
+    // this too, but can't report failures.
+    void close() {
+      if (!m_file)
+        return;
+      flush();
+      if (std::fclose(m_file.release()) != 0)
+        throw std::system_error(errno, std::generic_category(), "failed closing " + m_path);
+    }
+  };
+
+  // Reads the records of a trace file in order
+  template<typename K, typename V>
+  class reader {
+    std::unique_ptr<std::FILE, file_closer> m_file;
+    file_header m_header;
+    V m_initialVal;
+
+    template<typename T>
+    bool get(T& value) {
+      return std::fread(&value, sizeof(T), 1, m_file.get()) == 1;
+    }
+
+  public:
+    // Throws std::system_error if path can't be opened and std::runtime_error
+    // if it isn't a trace for these key and value types
+    explicit reader(const std::string& path) : m_file(std::fopen(path.c_str(), "rb")) {
+      if (!m_file)
+        throw std::system_error(errno, std::generic_category(), "can't open " + path);
+      if (!get(m_header) || std::memcmp(m_header.magic, magic, sizeof(magic)) != 0)
+        throw std::runtime_error(path + " is not an interval_map trace");
+      if (m_header.version != version)
+        throw std::runtime_error("unsupported trace version " + std::to_string(m_header.version));
+      if (m_header.keySize != sizeof(K) || m_header.valSize != sizeof(V))
+        throw std::runtime_error(path + " was recorded with different key or value types");
+      if (!get(m_initialVal))
+        throw std::runtime_error(path + " is truncated");
+    }
+
+    const file_header& header() const { return m_header; }
+    V const& initial_value() const { return m_initialVal; }
+
+    // Read the next record, returning false at the end of the trace. A
+    // truncated final record is treated as the end.
+    bool next(record<K, V>& r) {
+      if (!get(r.op) || !get(r.keyBegin))
+        return false;
+      if (r.op == op_lookup)
+        return true;
+      if (r.op != op_assign)
+        throw std::runtime_error("unknown trace operation " + std::to_string(r.op));
+      return get(r.keyEnd) && get(r.val);
+    }
+  };
+
+  // Read a whole trace into memory, so replaying it doesn't time the file I/O
+  template<typename K, typename V>
+  std::vector<record<K, V>> read_all(reader<K, V>& in) {
+    std::vector<record<K, V>> records;
+    record<K, V> r;
+    while (in.next(r))
+      records.push_back(r);
+    return records;
+  }
+
+  struct replay_stats {
+    std::uint64_t assigns = 0;
+    std::uint64_t lookups = 0;
+    std::chrono::nanoseconds elapsed{ 0 };
+    // Hash of every looked up value, to check that backends agree
+    std::uint64_t lookupChecksum = interval_map_file::checksumSeed;
+  };
+
+  // Replay records against any map with assign and operator[], timing the
+  // whole run
+  template<typename Map, typename K, typename V>
+  replay_stats replay(Map& map, const std::vector<record<K, V>>& records) {
+    replay_stats stats;
+    const auto start = std::chrono::steady_clock::now();
+    for (const auto& r : records) {
+      if (r.op == op_assign) {
+        map.assign(r.keyBegin, r.keyEnd, r.val);
+        ++stats.assigns;
+      }
+      else {
+        const V val = map[r.keyBegin];
+        stats.lookupChecksum = interval_map_file::checksum(&val, sizeof(V), stats.lookupChecksum);
+        ++stats.lookups;
+      }
+    }
+    stats.elapsed = std::chrono::steady_clock::now() - start;
+    return stats;
+  }
+
+}
+
+// Opt-in recording wrapper: forwards assign and operator[] to an
+// interval_map (or another map with the same interface) and logs every call
+// to a trace
+template<typename K, typename V, typename Map = interval_map<K, V>>
+class recording_interval_map {
+  Map m_map;
+  interval_map_trace::writer<K, V> m_trace;
+
+public:
+  recording_interval_map(const std::string& tracePath, V const& val, bool anonymizeKeys = false)
+    : m_map(val), m_trace(tracePath, val, anonymizeKeys) {}
+
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    m_trace.record_assign(keyBegin, keyEnd, val);
+    m_map.assign(keyBegin, keyEnd, val);
+  }
+
+  decltype(auto) operator[](K const& key) {
+    m_trace.record_lookup(key);
+    return m_map[key];
+  }
+
+  void flush() { m_trace.flush(); }
+
+  // Write out every record and close the trace, reporting failures
+  void close() { m_trace.close(); }
+
+  const Map& map() const { return m_map; }
+};
@@ -0,0 +1,105 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <utility>
+
+// The treap skeleton shared by the tree-based interval maps: a binary search
+// tree on keys that is a heap on random priorities, and so balanced with high
+// probability. Maps bring their own node type, with at least key, priority,
+// left, right and a subtree size, and hooks that say how to treat nodes as
+// split and merge pass through them:
+//
+//   static void open(node& n);                  // before its children are used
+//   static Link join(Link n, Link left, Link right);  // n with new children
+//
+// open is where lazily applied updates get pushed down to the children, and
+// join recomputes cached subtree data, or copies n for persistent trees.
+namespace interval_map_treap {
+
+  // splitmix64, a cheap stream of well mixed priorities. Every instance,
+  // copies included, starts from its own seed, drawn from a global counter,
+  // so trees built by different maps and joined by concat don't share
+  // priorities.
+  class priorities {
+    std::uint64_t m_state;
+
+    static std::uint64_t mix(std::uint64_t z) {
+      z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ull;
+      z = (z ^ (z >> 27)) * 0x94d049bb133111ebull;
+      return z ^ (z >> 31);
+    }
+
+    static std::uint64_t freshSeed() {
+      static std::atomic<std::uint64_t> counter{ 0 };
+      return mix(counter.fetch_add(0x9e3779b97f4a7c15ull, std::memory_order_relaxed));
+    }
+
+  public:
+    priorities() : m_state(freshSeed()) {}
+    priorities(const priorities&) noexcept : m_state(freshSeed()) {}
+    priorities& operator=(const priorities&) noexcept { return *this; }
+
+    std::uint64_t next() {
+      return mix(m_state += 0x9e3779b97f4a7c15ull);
+    }
+  };
+
+  template<typename Link>
+  std::size_t size_of(const Link& n) {
+    return n ? n->size : 0;
+  }
+
+  template<typename Node>
+  const Node* leftmost(const Node* n) {
+    while (n->left)
+      n = n->left.get();
+    return n;
+  }
+
+  template<typename Node>
+  const Node* rightmost(const Node* n) {
+    while (n->right)
+      n = n->right.get();
+    return n;
+  }
+
+  // Split t into the nodes before key and the rest. With keyGoesLeft, a node
+  // at key goes to the first part.
+  template<typename Hooks, typename Link, typename K>
+  std::pair<Link, Link> split(Link t, K const& key, bool keyGoesLeft) {
+    if (!t)
+      return {};
+    Hooks::open(*t);
+    const bool goesLeft = keyGoesLeft ? !(key < t->key) : t->key < key;
+    if (goesLeft) {
+      auto parts = split<Hooks>(std::move(t->right), key, keyGoesLeft);
+      Link left = std::move(t->left);
+      return { Hooks::join(std::move(t), std::move(left), std::move(parts.first)), std::move(parts.second) };
+    }
+    auto parts = split<Hooks>(std::move(t->left), key, keyGoesLeft);
+    Link right = std::move(t->right);
+    return { std::move(parts.first), Hooks::join(std::move(t), std::move(parts.second), std::move(right)) };
+  }
+
+  // Join two trees, every key of a being less than every key of b
+  template<typename Hooks, typename Link>
+  Link merge(Link a, Link b) {
+    if (!a)
+      return b;
+    if (!b)
+      return a;
+    if (a->priority > b->priority) {
+      Hooks::open(*a);
+      Link left = std::move(a->left);
+      Link right = merge<Hooks>(std::move(a->right), std::move(b));
+      return Hooks::join(std::move(a), std::move(left), std::move(right));
+    }
+    Hooks::open(*b);
+    Link right = std::move(b->right);
+    Link left = merge<Hooks>(std::move(a), std::move(b->left));
+    return Hooks::join(std::move(b), std::move(left), std::move(right));
+  }
+
+}
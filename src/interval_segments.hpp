@@ -0,0 +1,166 @@
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <optional>
+
+// One run of a single value, [keyBegin, keyEnd) -> val. val refers into the
+// map it came from and stays valid until the map is next modified.
+template<typename K, typename V>
+struct interval_segment {
+  K keyBegin;
+  K keyEnd;
+  V const& val;
+};
+
+// A whole run of a single value, as found by segment_containing, next_change
+// and prev_change. The first run of a map has no keyBegin and the last no
+// keyEnd, as they extend to the ends of the key space.
+template<typename K, typename V>
+struct interval_run {
+  std::optional<K> keyBegin;
+  std::optional<K> keyEnd;
+  V const& val;
+};
+
+// The run starting at boundary it, in a map whose boundaries run from first
+// to end
+template<typename K, typename V, typename Cursor>
+interval_run<K, V> run_at(Cursor it, Cursor first, Cursor end) {
+  Cursor next = it;
+  ++next;
+  return {
+    it == first ? std::nullopt : std::optional<K>(it.key()),
+    next == end ? std::nullopt : std::optional<K>(next.key()),
+    it.value()
+  };
+}
+
+// Walk the boundaries of two maps together in key order, calling
+// emit(key, aVal, bVal) with a pointer to each key where either map changes
+// and the values of both maps from there on. Both sequences start with the run
+// below every key, which is emitted first with a null key, so this takes
+// O(n + m) for maps of n and m boundaries.
+template<typename CursorA, typename CursorB, typename Emit>
+void sweep_boundaries(CursorA a, CursorA aEnd, CursorB b, CursorB bEnd, Emit&& emit) {
+  const auto* aVal = &a.value();
+  const auto* bVal = &b.value();
+  emit(static_cast<decltype(&a.key())>(nullptr), *aVal, *bVal);
+
+  ++a;
+  ++b;
+  while (a != aEnd || b != bEnd) {
+    const auto* key = b == bEnd || (a != aEnd && a.key() < b.key()) ? &a.key() : &b.key();
+    if (a != aEnd && !(*key < a.key())) {
+      aVal = &a.value();
+      ++a;
+    }
+    if (b != bEnd && !(*key < b.key())) {
+      bVal = &b.value();
+      ++b;
+    }
+    emit(key, *aVal, *bVal);
+  }
+}
+
+// Cursor over boundaries stored as (key, value) pairs, such as std::map nodes
+template<typename It>
+class pair_cursor {
+  It m_it;
+
+public:
+  pair_cursor() = default;
+  explicit pair_cursor(It it) : m_it(it) {}
+
+  const auto& key() const { return m_it->first; }
+  const auto& value() const { return m_it->second; }
+
+  pair_cursor& operator++() { ++m_it; return *this; }
+  pair_cursor& operator--() { --m_it; return *this; }
+  bool operator==(const pair_cursor& other) const { return m_it == other.m_it; }
+  bool operator!=(const pair_cursor& other) const { return m_it != other.m_it; }
+};
+
+// Cursor over boundaries stored as parallel key and value arrays
+template<typename K, typename V>
+class array_cursor {
+  const K* m_keys = nullptr;
+  const V* m_vals = nullptr;
+  std::size_t m_index = 0;
+
+public:
+  array_cursor() = default;
+  array_cursor(const K* keys, const V* vals, std::size_t index) : m_keys(keys), m_vals(vals), m_index(index) {}
+
+  K const& key() const { return m_keys[m_index]; }
+  V const& value() const { return m_vals[m_index]; }
+
+  array_cursor& operator++() { ++m_index; return *this; }
+  array_cursor& operator--() { --m_index; return *this; }
+  bool operator==(const array_cursor& other) const { return m_index == other.m_index; }
+  bool operator!=(const array_cursor& other) const { return m_index != other.m_index; }
+};
+
+// The segments of a map clipped to [lo, hi), in key order. It walks a
+// Cursor over the map's boundaries from first, the boundary holding lo, up to
+// last, the first boundary at or after hi, so each backend only has to find
+// those two and iteration is sequential from there on, in either direction.
+// Segments are built on the fly and never copy values.
+template<typename K, typename V, typename Cursor>
+class segment_view {
+  Cursor m_first;
+  Cursor m_last;
+  K m_lo;
+  K m_hi;
+
+public:
+  class iterator {
+    const segment_view* m_view = nullptr;
+    Cursor m_it;
+
+  public:
+    using iterator_category = std::bidirectional_iterator_tag;
+    using value_type = interval_segment<K, V>;
+    using difference_type = std::ptrdiff_t;
+    using pointer = void;
+    using reference = interval_segment<K, V>;
+
+    iterator() = default;
+    iterator(const segment_view* view, Cursor it) : m_view(view), m_it(it) {}
+
+    reference operator*() const {
+      Cursor next = m_it;
+      ++next;
+      // The first boundary may lie before lo (or, for sparse maps, have no
+      // key at all), so the first segment always starts at lo
+      const K& keyBegin = m_it == m_view->m_first ? m_view->m_lo : m_it.key();
+      const K& keyEnd = next == m_view->m_last ? m_view->m_hi : next.key();
+      return { keyBegin, keyEnd, m_it.value() };
+    }
+
+    iterator& operator++() { ++m_it; return *this; }
+    iterator& operator--() { --m_it; return *this; }
+    iterator operator++(int) { iterator old = *this; ++m_it; return old; }
+    iterator operator--(int) { iterator old = *this; --m_it; return old; }
+    bool operator==(const iterator& other) const { return m_it == other.m_it; }
+    bool operator!=(const iterator& other) const { return m_it != other.m_it; }
+  };
+
+  using reverse_iterator = std::reverse_iterator<iterator>;
+
+  // first and last as described above. An empty [lo, hi) must pass
+  // first == last.
+  segment_view(Cursor first, Cursor last, K const& lo, K const& hi)
+    : m_first(first), m_last(last), m_lo(lo), m_hi(hi) {}
+
+  // The view refers to itself from its iterators
+  segment_view(const segment_view&) = delete;
+  segment_view& operator=(const segment_view&) = delete;
+
+  iterator begin() const { return iterator(this, m_first); }
+  iterator end() const { return iterator(this, m_last); }
+  reverse_iterator rbegin() const { return reverse_iterator(end()); }
+  reverse_iterator rend() const { return reverse_iterator(begin()); }
+
+  bool empty() const { return m_first == m_last; }
+};
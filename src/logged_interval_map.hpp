@@ -0,0 +1,373 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "interval_map.hpp"
+#include "interval_map_file.hpp"
+#include "mapped_interval_map.hpp"
+
+struct wal_options {
+  // Assignments buffered before they are written and synced to the log as one
+  // group. commit() flushes a partial group.
+  std::size_t groupCommitRecords = 1024;
+  // Fold the log into a new snapshot in the background once it grows past
+  // this many bytes (0 disables)
+  std::uint64_t compactAfterBytes = 64ull << 20;
+  // Also fold it periodically, if anything was logged (0 disables)
+  std::chrono::milliseconds compactInterval{ 0 };
+};
+
+// interval_map made durable by a write-ahead log. Every assign is appended to
+// the log as a checksummed binary record, and records are written and synced
+// in groups. Compaction writes the map as a snapshot (see interval_map::save)
+// and discards the log it covers.
+//
+// The directory holds snapshot-<g> and wal-<g> files. snapshot-<g> is the
+// state before any record of wal-<g>, so recovery loads the newest snapshot
+// and replays the logs from its generation on, ignoring a torn final record.
+template<typename K, typename V>
+class logged_interval_map {
+  static_assert(std::is_trivially_copyable<K>::value, "K must be trivially copyable");
+  static_assert(std::is_trivially_copyable<V>::value, "V must be trivially copyable");
+
+  static constexpr char logMagic[8] = { 'I', 'N', 'T', 'V', 'W', 'A', 'L', '\0' };
+  static constexpr std::uint32_t logVersion = 1;
+  static constexpr std::size_t logHeaderSize = sizeof(logMagic) + 3 * sizeof(std::uint32_t);
+  // checksum, keyBegin, keyEnd, val
+  static constexpr std::size_t recordSize = sizeof(std::uint32_t) + 2 * sizeof(K) + sizeof(V);
+
+  std::filesystem::path m_dir;
+  wal_options m_options;
+  interval_map<K, V> m_map;
+
+  // Guards the map and the log against the compaction thread
+  std::mutex m_mutex;
+  // Serialises compactions
+  std::mutex m_compactMutex;
+  std::FILE* m_log = nullptr;
+  std::uint64_t m_generation = 0;
+  std::uint64_t m_logBytes = 0;
+  std::vector<char> m_pending;
+  std::size_t m_pendingRecords = 0;
+
+  std::thread m_compactor;
+  std::condition_variable m_compactWake;
+  bool m_stop = false;
+  bool m_compactRequested = false;
+  std::exception_ptr m_compactError;
+
+  std::string filePath(const char* prefix, std::uint64_t generation) const {
+    return (m_dir / (prefix + std::to_string(generation))).string();
+  }
+
+  // The generation of a file named by filePath with prefix, or nothing if
+  // name isn't the prefix followed by the generation's digits
+  static std::optional<std::uint64_t> generationOf(const std::string& name, const std::string& prefix) {
+    if (name.size() <= prefix.size() || name.size() > prefix.size() + 19 || name.compare(0, prefix.size(), prefix) != 0)
+      return std::nullopt;
+    std::uint64_t generation = 0;
+    for (std::size_t i = prefix.size(); i < name.size(); ++i) {
+      if (name[i] < '0' || name[i] > '9')
+        return std::nullopt;
+      generation = generation * 10 + (name[i] - '0');
+    }
+    // Leading zeros would name a different file than filePath gives
+    if (name.compare(prefix.size(), std::string::npos, std::to_string(generation)) != 0)
+      return std::nullopt;
+    return generation;
+  }
+
+  static std::uint32_t recordChecksum(const char* payload) {
+    return static_cast<std::uint32_t>(interval_map_file::checksum(payload, recordSize - sizeof(std::uint32_t)));
+  }
+
+  // Replay the records of the log at path onto m_map, returning the size of
+  // its valid prefix. Replay stops at the first short or damaged record,
+  // which is what a crash in the middle of a group commit leaves behind.
+  std::uint64_t replay(const std::string& path) {
+    std::FILE* file = std::fopen(path.c_str(), "rb");
+    if (!file)
+      throw std::system_error(errno, std::generic_category(), "can't open " + path);
+
+    char header[logHeaderSize];
+    const std::uint32_t expected[3] = { logVersion, sizeof(K), sizeof(V) };
+    if (std::fread(header, 1, logHeaderSize, file) != logHeaderSize) {
+      // A log whose header never made it to disk has no records either
+      std::fclose(file);
+      return 0;
+    }
+    if (std::memcmp(header, logMagic, sizeof(logMagic)) != 0
+        || std::memcmp(header + sizeof(logMagic), expected, sizeof(expected)) != 0) {
+      std::fclose(file);
+      throw std::runtime_error(path + " isn't a log for these key and value types");
+    }
+
+    std::uint64_t valid = logHeaderSize;
+    char record[recordSize];
+    while (std::fread(record, 1, recordSize, file) == recordSize) {
+      std::uint32_t checksum;
+      std::memcpy(&checksum, record, sizeof(checksum));
+      const char* payload = record + sizeof(checksum);
+      if (checksum != recordChecksum(payload))
+        break;
+
+      K keyBegin, keyEnd;
+      V val;
+      std::memcpy(&keyBegin, payload, sizeof(K));
+      std::memcpy(&keyEnd, payload + sizeof(K), sizeof(K));
+      std::memcpy(&val, payload + 2 * sizeof(K), sizeof(V));
+      m_map.assign(keyBegin, keyEnd, val);
+      valid += recordSize;
+    }
+
+    std::fclose(file);
+    return valid;
+  }
+
+  void recover(V const& val) {
+    std::vector<std::uint64_t> snapshots;
+    std::vector<std::uint64_t> logs;
+    for (const auto& entry : std::filesystem::directory_iterator(m_dir)) {
+      const std::string name = entry.path().filename().string();
+      // Temporary files of unfinished snapshot saves
+      if (name.find(".tmp.") != std::string::npos) {
+        std::filesystem::remove(entry.path());
+      }
+      else if (const auto generation = generationOf(name, "snapshot-")) {
+        snapshots.push_back(*generation);
+      }
+      else if (const auto generation = generationOf(name, "wal-")) {
+        logs.push_back(*generation);
+      }
+      // Anything else isn't ours and is left alone
+    }
+    std::sort(logs.begin(), logs.end());
+
+    std::uint64_t base = 0;
+    if (!snapshots.empty()) {
+      base = *std::max_element(snapshots.begin(), snapshots.end());
+      auto snapshot = mapped_interval_map<K, V>::open(filePath("snapshot-", base));
+      std::vector<std::pair<K, V>> boundaries;
+      boundaries.reserve(snapshot.size());
+      for (std::size_t i = 0; i < snapshot.size(); ++i)
+        boundaries.emplace_back(snapshot.keys()[i], snapshot.values()[i]);
+      m_map = interval_map<K, V>(val, boundaries.begin(), boundaries.end());
+    }
+
+    m_generation = base;
+    for (std::uint64_t generation : logs) {
+      const std::string path = filePath("wal-", generation);
+      if (generation < base) {
+        std::filesystem::remove(path);
+        continue;
+      }
+
+      // Cut off a torn tail so the log stays replayable once newer logs follow it
+      const std::uint64_t valid = replay(path);
+      if (valid < std::filesystem::file_size(path))
+        std::filesystem::resize_file(path, valid);
+      m_generation = generation;
+    }
+    for (std::uint64_t generation : snapshots) {
+      if (generation < base)
+        std::filesystem::remove(filePath("snapshot-", generation));
+    }
+  }
+
+  // Start logging to a new, empty wal-<m_generation + 1>
+  void openNextLog() {
+    if (m_log)
+      std::fclose(m_log);
+
+    ++m_generation;
+    const std::string path = filePath("wal-", m_generation);
+    m_log = std::fopen(path.c_str(), "wb");
+    if (!m_log)
+      throw std::system_error(errno, std::generic_category(), "can't open " + path + " for writing");
+
+    const std::uint32_t header[3] = { logVersion, sizeof(K), sizeof(V) };
+    interval_map_file::writeBytes(m_log, logMagic, sizeof(logMagic), path);
+    interval_map_file::writeBytes(m_log, header, sizeof(header), path);
+    interval_map_file::syncFile(m_log, path);
+    interval_map_file::syncDirectory(m_dir);
+    m_logBytes = logHeaderSize;
+  }
+
+  void commitLocked() {
+    if (m_compactError)
+      std::rethrow_exception(std::exchange(m_compactError, nullptr));
+    if (m_pending.empty())
+      return;
+
+    const std::string path = filePath("wal-", m_generation);
+    interval_map_file::writeBytes(m_log, m_pending.data(), m_pending.size(), path);
+    interval_map_file::syncFile(m_log, path);
+    m_logBytes += m_pending.size();
+    m_pending.clear();
+    m_pendingRecords = 0;
+
+    if (m_options.compactAfterBytes && m_logBytes >= m_options.compactAfterBytes && m_compactor.joinable()) {
+      m_compactRequested = true;
+      m_compactWake.notify_one();
+    }
+  }
+
+  void compactorLoop() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_stop) {
+      const auto wake = [this]() { return m_stop || m_compactRequested; };
+      bool requested;
+      if (m_options.compactInterval.count() > 0)
+        requested = m_compactWake.wait_for(lock, m_options.compactInterval, wake);
+      else
+        requested = (m_compactWake.wait(lock, wake), true);
+      if (m_stop)
+        break;
+
+      // Periodic compactions are skipped if nothing was logged since the last one
+      if (!requested && m_logBytes == logHeaderSize && m_pending.empty())
+        continue;
+      m_compactRequested = false;
+
+      lock.unlock();
+      try {
+        compact();
+      }
+      catch (...) {
+        std::lock_guard<std::mutex> errorLock(m_mutex);
+        m_compactError = std::current_exception();
+      }
+      lock.lock();
+    }
+  }
+
+public:
+  // Open the map stored in dir, creating the directory if needed. Keys map to
+  // val until assigned, as with interval_map. Throws std::system_error or
+  // std::filesystem::filesystem_error on I/O errors and std::runtime_error if
+  // the stored files are for other key or value types.
+  logged_interval_map(const std::string& dir, V const& val, wal_options options = {})
+    : m_dir(dir), m_options(options), m_map(val) {
+    std::filesystem::create_directories(m_dir);
+    recover(val);
+    openNextLog();
+
+    if (m_options.compactAfterBytes || m_options.compactInterval.count() > 0)
+      m_compactor = std::thread([this]() { compactorLoop(); });
+  }
+
+  logged_interval_map(const logged_interval_map&) = delete;
+  logged_interval_map& operator=(const logged_interval_map&) = delete;
+
+  // Commits any buffered assignments; errors doing so are lost, so call
+  // commit() first to see them
+  ~logged_interval_map() {
+    {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+    }
+    m_compactWake.notify_one();
+    if (m_compactor.joinable())
+      m_compactor.join();
+
+    try {
+      commitLocked();
+    }
+    catch (...) {
+    }
+    std::fclose(m_log);
+  }
+
+  // Assign value val to interval [keyBegin, keyEnd), as interval_map::assign.
+  // The assignment is durable once its group has been committed.
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_map.assign(keyBegin, keyEnd, val);
+
+    const std::size_t offset = m_pending.size();
+    m_pending.resize(offset + recordSize);
+    char* payload = m_pending.data() + offset + sizeof(std::uint32_t);
+    std::memcpy(payload, &keyBegin, sizeof(K));
+    std::memcpy(payload + sizeof(K), &keyEnd, sizeof(K));
+    std::memcpy(payload + 2 * sizeof(K), &val, sizeof(V));
+    const std::uint32_t checksum = recordChecksum(payload);
+    std::memcpy(m_pending.data() + offset, &checksum, sizeof(checksum));
+
+    if (++m_pendingRecords >= m_options.groupCommitRecords)
+      commitLocked();
+  }
+
+  // Map [keyBegin, keyEnd) back to the value the map was constructed with,
+  // logged as an ordinary assignment
+  void reset(K const& keyBegin, K const& keyEnd) {
+    assign(keyBegin, keyEnd, m_map.default_value());
+  }
+
+  // Write and sync all buffered assignments to the log. Also rethrows any
+  // error from a background compaction.
+  void commit() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    commitLocked();
+  }
+
+  // Fold everything logged so far into a new snapshot and delete the logs and
+  // snapshots it replaces. Only copying the map blocks assign; the snapshot is
+  // written without holding the lock.
+  void compact() {
+    std::lock_guard<std::mutex> compactLock(m_compactMutex);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    commitLocked();
+    openNextLog();
+    const std::uint64_t generation = m_generation;
+    const interval_map<K, V> snapshot = m_map;
+    lock.unlock();
+
+    snapshot.save(filePath("snapshot-", generation));
+    for (const auto& entry : std::filesystem::directory_iterator(m_dir)) {
+      const std::string name = entry.path().filename().string();
+      auto old = generationOf(name, "snapshot-");
+      if (!old)
+        old = generationOf(name, "wal-");
+      if (old && *old < generation)
+        std::filesystem::remove(entry.path());
+    }
+  }
+
+  // look-up of the value associated with key. Must not race with assign.
+  V const& operator[](K const& key) const {
+    return m_map[key];
+  }
+
+  // Segments of [lo, hi), as interval_map::segments. Must not race with
+  // assign.
+  auto segments(K const& lo, K const& hi) const {
+    return m_map.segments(lo, hi);
+  }
+
+  // Navigation between runs, as in interval_map. Must not race with assign.
+  interval_run<K, V> segment_containing(K const& key) const { return m_map.segment_containing(key); }
+  std::optional<interval_run<K, V>> next_change(K const& key) const { return m_map.next_change(key); }
+  std::optional<interval_run<K, V>> prev_change(K const& key) const { return m_map.prev_change(key); }
+
+  const interval_map<K, V>& map() const { return m_map; }
+};
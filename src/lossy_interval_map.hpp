@@ -0,0 +1,188 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <queue>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "interval_map.hpp"
+
+// Which intervals lossy_interval_map gives up first
+enum class lossy_merge {
+  // The shortest intervals
+  shortest,
+  // The intervals whose value is closest to a neighbour's
+  closest_value
+};
+
+struct lossy_options {
+  // Boundaries kept at most, including the one at the lowest key (at least 3)
+  std::size_t maxBoundaries = 1 << 16;
+  lossy_merge policy = lossy_merge::shortest;
+};
+
+// Error introduced by merging intervals
+struct lossy_error {
+  std::uint64_t merges = 0;
+  // Sum of length * |value change| over all merges. This bounds the L1
+  // distance between the map and the one exact assignment would have built.
+  double area = 0;
+  // Largest value change of a single merge. A key merged repeatedly may
+  // drift by the sum of its merges.
+  double maxValueError = 0;
+};
+
+// interval_map for arithmetic keys and values that holds a bounded number of
+// boundaries. When an assign pushes the map past maxBoundaries, interior
+// intervals are merged into their closer-valued neighbour until it fits
+// again, in the order chosen by the policy. Candidates are kept in a heap
+// and checked against the map when popped, so each merge costs O(log n)
+// amortised.
+template<typename K, typename V>
+class lossy_interval_map {
+  static_assert(std::is_arithmetic<K>::value, "K must be arithmetic to measure interval lengths");
+  static_assert(std::is_arithmetic<V>::value, "V must be arithmetic to measure value distances");
+
+  using iterator = typename std::map<K, V>::const_iterator;
+
+  struct candidate {
+    double priority;
+    K keyBegin;
+    K keyEnd;
+    V val;
+
+    bool operator>(const candidate& other) const { return priority > other.priority; }
+  };
+
+  interval_map<K, V> m_map;
+  lossy_options m_options;
+  lossy_error m_error;
+  std::priority_queue<candidate, std::vector<candidate>, std::greater<candidate>> m_candidates;
+
+  static double distance(V const& a, V const& b) {
+    return std::abs(double(a) - double(b));
+  }
+
+  // Priority of merging the interval starting at it, which must be interior
+  double priority(iterator it) const {
+    if (m_options.policy == lossy_merge::shortest)
+      return double(std::next(it)->first) - double(it->first);
+    return std::min(distance(it->second, std::prev(it)->second), distance(it->second, std::next(it)->second));
+  }
+
+  // The first and last intervals are unbounded, so only interior ones merge
+  bool interior(iterator it) const {
+    const auto& map = m_map.map();
+    return it != map.end() && it != map.begin() && std::next(it) != map.end();
+  }
+
+  void push(iterator it) {
+    if (interior(it))
+      m_candidates.push({ priority(it), it->first, std::next(it)->first, it->second });
+  }
+
+  // Queue the interval holding key and its neighbours, whose priorities may
+  // have changed
+  void pushAround(K const& key) {
+    const auto& map = m_map.map();
+    auto it = std::prev(map.upper_bound(key));
+    if (it != map.begin())
+      push(std::prev(it));
+    push(it);
+    push(std::next(it));
+  }
+
+  void rebuildCandidates() {
+    m_candidates = decltype(m_candidates)();
+    const auto& map = m_map.map();
+    for (auto it = map.begin(); it != map.end(); ++it)
+      push(it);
+  }
+
+  // Stale candidates pile up as intervals change, over budget or not; start
+  // afresh before they outnumber the live ones by much. Rebuilding takes
+  // O(n) and follows at least 3n pushes, so it adds O(1) per push.
+  void dropStaleCandidates() {
+    if (m_candidates.size() > 4 * m_map.map().size() + 64)
+      rebuildCandidates();
+  }
+
+  void enforceBudget() {
+    const auto& map = m_map.map();
+    dropStaleCandidates();
+    while (map.size() > m_options.maxBoundaries) {
+      if (m_candidates.empty())
+        rebuildCandidates();
+      else
+        dropStaleCandidates();
+
+      const candidate top = m_candidates.top();
+      m_candidates.pop();
+
+      // Skip candidates for intervals that have changed since
+      auto it = map.find(top.keyBegin);
+      if (!interior(it) || !(it->second == top.val) || std::next(it)->first != top.keyEnd)
+        continue;
+      const double current = priority(it);
+      if (current != top.priority) {
+        m_candidates.push({ current, top.keyBegin, top.keyEnd, top.val });
+        continue;
+      }
+
+      const V& prevVal = std::prev(it)->second;
+      const V& nextVal = std::next(it)->second;
+      const V mergedVal = distance(top.val, prevVal) <= distance(top.val, nextVal) ? prevVal : nextVal;
+      const double valueError = distance(top.val, mergedVal);
+      ++m_error.merges;
+      m_error.area += (double(top.keyEnd) - double(top.keyBegin)) * valueError;
+      m_error.maxValueError = std::max(m_error.maxValueError, valueError);
+
+      m_map.assign(top.keyBegin, top.keyEnd, mergedVal);
+      pushAround(top.keyBegin);
+    }
+  }
+
+public:
+  // Throws std::invalid_argument if maxBoundaries is below 3, which leaves
+  // no room for an interior interval
+  lossy_interval_map(V const& val, lossy_options options = {})
+    : m_map(val), m_options(options) {
+    if (m_options.maxBoundaries < 3)
+      throw std::invalid_argument("lossy_interval_map needs maxBoundaries of at least 3");
+  }
+
+  // Assign value val to interval [keyBegin, keyEnd), then merge intervals
+  // until the map fits in maxBoundaries again. Those merges may overwrite
+  // part of this very assignment.
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    m_map.assign(keyBegin, keyEnd, val);
+    pushAround(keyBegin);
+    pushAround(keyEnd);
+    enforceBudget();
+  }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const {
+    return m_map[key];
+  }
+
+  // Error introduced by all merges so far
+  const lossy_error& error() const { return m_error; }
+
+  const lossy_options& options() const { return m_options; }
+
+  // Merge candidates queued, stale ones included, which stays within a
+  // constant factor of the boundaries
+  std::size_t candidate_count() const { return m_candidates.size(); }
+
+  const interval_map<K, V>& map() const { return m_map; }
+};
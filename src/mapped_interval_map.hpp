@@ -0,0 +1,243 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <stdexcept>
+#include <string>
+#include <system_error>
+#include <type_traits>
+#include <utility>
+
+#ifdef _WIN32
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "interval_map_file.hpp"
+#include "interval_map_memory.hpp"
+#include "interval_segments.hpp"
+
+// Read-only interval_map backed by a file written by interval_map::save. The
+// file is mapped shared and searched in place, so opening it only validates
+// the header: pages are faulted in as lookups touch them, and processes
+// mapping the same file share them.
+template<typename K, typename V>
+class mapped_interval_map {
+  static_assert(std::is_trivially_copyable<K>::value, "K must be trivially copyable");
+  static_assert(std::is_trivially_copyable<V>::value, "V must be trivially copyable");
+
+  const void* m_data = nullptr;
+  std::size_t m_length = 0;
+#ifdef _WIN32
+  HANDLE m_mapping = nullptr;
+#endif
+  const interval_map_file::file_header* m_header = nullptr;
+  const K* m_keys = nullptr;
+  const V* m_vals = nullptr;
+
+  mapped_interval_map() = default;
+
+  interval_run<K, V> runAt(std::size_t index) const {
+    using cursor = array_cursor<K, V>;
+    return run_at<K, V>(cursor(m_keys, m_vals, index), cursor(m_keys, m_vals, 0), cursor(m_keys, m_vals, size()));
+  }
+
+  void unmap() {
+#ifdef _WIN32
+    if (m_data)
+      UnmapViewOfFile(m_data);
+    if (m_mapping)
+      CloseHandle(m_mapping);
+    m_mapping = nullptr;
+#else
+    if (m_data)
+      munmap(const_cast<void*>(m_data), m_length);
+#endif
+    m_data = nullptr;
+  }
+
+  void mapFile(const std::string& path) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+      OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+      throw std::system_error(GetLastError(), std::system_category(), "can't open " + path);
+
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size)) {
+      CloseHandle(file);
+      throw std::system_error(GetLastError(), std::system_category(), "can't stat " + path);
+    }
+    m_length = static_cast<std::size_t>(size.QuadPart);
+    if (m_length < sizeof(interval_map_file::file_header)) {
+      CloseHandle(file);
+      throw std::runtime_error(path + " is too small to be an interval_map file");
+    }
+
+    m_mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!m_mapping)
+      throw std::system_error(GetLastError(), std::system_category(), "can't map " + path);
+    m_data = MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0);
+    if (!m_data) {
+      const DWORD error = GetLastError();
+      unmap();
+      throw std::system_error(error, std::system_category(), "can't map " + path);
+    }
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+      throw std::system_error(errno, std::generic_category(), "can't open " + path);
+
+    struct stat info;
+    if (fstat(fd, &info) != 0) {
+      const int error = errno;
+      ::close(fd);
+      throw std::system_error(error, std::generic_category(), "can't stat " + path);
+    }
+    m_length = static_cast<std::size_t>(info.st_size);
+    if (m_length < sizeof(interval_map_file::file_header)) {
+      ::close(fd);
+      throw std::runtime_error(path + " is too small to be an interval_map file");
+    }
+
+    void* data = mmap(nullptr, m_length, PROT_READ, MAP_SHARED, fd, 0);
+    const int error = errno;
+    ::close(fd);
+    if (data == MAP_FAILED)
+      throw std::system_error(error, std::generic_category(), "can't map " + path);
+    m_data = data;
+#endif
+  }
+
+public:
+  // Map the file at path, validating its header. Throws std::system_error if
+  // the file can't be mapped and std::runtime_error if it isn't a valid
+  // interval_map file for these key and value types.
+  static mapped_interval_map open(const std::string& path) {
+    mapped_interval_map map;
+    map.mapFile(path);
+
+    const char* bytes = static_cast<const char*>(map.m_data);
+    map.m_header = reinterpret_cast<const interval_map_file::file_header*>(bytes);
+    interval_map_file::validateHeader<K, V>(*map.m_header, map.m_length);
+    map.m_keys = reinterpret_cast<const K*>(bytes + map.m_header->keysOffset);
+    map.m_vals = reinterpret_cast<const V*>(bytes + map.m_header->valsOffset);
+    if (K(std::numeric_limits<K>::lowest()) < map.m_keys[0])
+      throw std::runtime_error(path + " doesn't start at the lowest key");
+    return map;
+  }
+
+  mapped_interval_map(mapped_interval_map&& other) noexcept { *this = std::move(other); }
+
+  mapped_interval_map& operator=(mapped_interval_map&& other) noexcept {
+    if (this != &other) {
+      unmap();
+      m_data = std::exchange(other.m_data, nullptr);
+      m_length = std::exchange(other.m_length, 0);
+#ifdef _WIN32
+      m_mapping = std::exchange(other.m_mapping, nullptr);
+#endif
+      m_header = std::exchange(other.m_header, nullptr);
+      m_keys = std::exchange(other.m_keys, nullptr);
+      m_vals = std::exchange(other.m_vals, nullptr);
+    }
+    return *this;
+  }
+
+  ~mapped_interval_map() { unmap(); }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const {
+    return m_vals[std::upper_bound(m_keys, m_keys + size(), key) - m_keys - 1];
+  }
+
+  // The segments of [lo, hi), clipped to it, as interval_map::segments
+  segment_view<K, V, array_cursor<K, V>> segments(K const& lo, K const& hi) const {
+    using cursor = array_cursor<K, V>;
+    if (!(lo < hi))
+      return { cursor(m_keys, m_vals, size()), cursor(m_keys, m_vals, size()), lo, hi };
+    const std::size_t first = std::upper_bound(m_keys, m_keys + size(), lo) - m_keys - 1;
+    const std::size_t last = std::lower_bound(m_keys, m_keys + size(), hi) - m_keys;
+    return { cursor(m_keys, m_vals, first), cursor(m_keys, m_vals, last), lo, hi };
+  }
+
+  // The run of a single value holding key, as interval_map::segment_containing
+  interval_run<K, V> segment_containing(K const& key) const {
+    return runAt(std::upper_bound(m_keys, m_keys + size(), key) - m_keys - 1);
+  }
+
+  // The run after the one holding key, as interval_map::next_change
+  std::optional<interval_run<K, V>> next_change(K const& key) const {
+    const std::size_t index = std::upper_bound(m_keys, m_keys + size(), key) - m_keys;
+    if (index == size())
+      return std::nullopt;
+    return runAt(index);
+  }
+
+  // The run before the one holding key, as interval_map::prev_change
+  std::optional<interval_run<K, V>> prev_change(K const& key) const {
+    const std::size_t index = std::upper_bound(m_keys, m_keys + size(), key) - m_keys - 1;
+    if (index == 0)
+      return std::nullopt;
+    return runAt(index - 1);
+  }
+
+  // The k-th run of a single value in key order, counting from 0. The
+  // boundaries are an array, so this is O(1). Throws std::out_of_range if
+  // there are no more than k runs.
+  interval_run<K, V> nth_segment(std::size_t k) const {
+    if (k >= size())
+      throw std::out_of_range("mapped_interval_map::nth_segment past the last segment");
+    return runAt(k);
+  }
+
+  // Index of the run holding key
+  std::size_t rank(K const& key) const {
+    return std::upper_bound(m_keys, m_keys + size(), key) - m_keys - 1;
+  }
+
+  // Number of runs overlapping [lo, hi)
+  std::size_t count_segments(K const& lo, K const& hi) const {
+    if (!(lo < hi))
+      return 0;
+    return 1 + (std::lower_bound(m_keys, m_keys + size(), hi) - std::upper_bound(m_keys, m_keys + size(), lo));
+  }
+
+  // Check the stored keys and values against the checksum written with them.
+  // This reads the whole file, so it's kept out of open.
+  bool verify() const {
+    std::uint64_t hash = interval_map_file::checksum(m_keys, size() * sizeof(K));
+    hash = interval_map_file::checksum(m_vals, size() * sizeof(V), hash);
+    return hash == m_header->payloadChecksum;
+  }
+
+  // Bytes of the mapped file. The file header and alignment padding count as
+  // overhead and the rest of the last page as slack. The pages are shared
+  // with the page cache rather than allocated.
+  interval_map_memory memory_usage() const {
+    constexpr std::size_t pageSize = 4096;
+    interval_map_memory usage;
+    usage.values = size() * (sizeof(K) + sizeof(V));
+    usage.overhead = m_length - usage.values;
+    usage.slack = (m_length + pageSize - 1) / pageSize * pageSize - m_length;
+    return usage;
+  }
+
+  // Number of boundaries, including the one at the lowest key
+  std::size_t size() const { return static_cast<std::size_t>(m_header->count); }
+
+  // Sorted boundary keys and the values starting at them
+  const K* keys() const { return m_keys; }
+  const V* values() const { return m_vals; }
+};
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "interval_map_memory.hpp"
+
+// Interval map over a fixed domain [domainBegin, domainEnd) of integral keys
+// with numeric values, supporting range add and range sum, min and max on top
+// of assign. It's a segment tree over the key domain whose nodes are created
+// only where an update splits a range. A node without children holds one value
+// for its whole range; a node with children may hold an add not yet pushed
+// down to them. Assigning over a node's whole range frees its subtree.
+//
+// Every operation costs O(log D) for a domain of D keys, and memory grows
+// with the number of distinct update ends rather than D.
+template<typename K, typename V>
+class numeric_interval_map {
+  static_assert(std::is_integral<K>::value, "K must be integral to split the key domain");
+  static_assert(std::is_arithmetic<V>::value, "V must be arithmetic to add and aggregate");
+
+public:
+  // Sums are widened so that adding up many values doesn't overflow V
+  using sum_type = std::common_type_t<V, std::int64_t>;
+
+  struct aggregate_result {
+    sum_type sum;
+    V min;
+    V max;
+  };
+
+private:
+  using offset = std::make_unsigned_t<K>;
+
+  struct node {
+    sum_type sum;
+    V min;
+    V max;
+    // Add that still has to be applied to both children
+    V pendingAdd;
+    std::uint32_t left;
+    std::uint32_t right;
+  };
+
+  static constexpr std::uint32_t none = 0;
+  static constexpr std::uint32_t root = 0;
+
+  std::vector<node> m_nodes;
+  std::vector<std::uint32_t> m_free;
+  K m_begin;
+  K m_end;
+
+  // Unsigned arithmetic, so a domain spanning all of K doesn't overflow
+  static offset length(K lo, K hi) { return offset(offset(hi) - offset(lo)); }
+  static K middle(K lo, K hi) { return K(offset(lo) + length(lo, hi) / 2); }
+
+  static node uniform(V val, offset len) {
+    return { sum_type(val) * sum_type(len), val, val, V(0), none, none };
+  }
+
+  std::uint32_t allocate(const node& n) {
+    if (!m_free.empty()) {
+      const std::uint32_t index = m_free.back();
+      m_free.pop_back();
+      m_nodes[index] = n;
+      return index;
+    }
+    m_nodes.push_back(n);
+    return static_cast<std::uint32_t>(m_nodes.size() - 1);
+  }
+
+  // Put the subtrees below index on the free list
+  void release(std::uint32_t index) {
+    std::vector<std::uint32_t> stack;
+    if (m_nodes[index].left != none) {
+      stack.push_back(m_nodes[index].left);
+      stack.push_back(m_nodes[index].right);
+    }
+    m_nodes[index].left = m_nodes[index].right = none;
+    while (!stack.empty()) {
+      const std::uint32_t child = stack.back();
+      stack.pop_back();
+      if (m_nodes[child].left != none) {
+        stack.push_back(m_nodes[child].left);
+        stack.push_back(m_nodes[child].right);
+      }
+      m_free.push_back(child);
+    }
+  }
+
+  static void applyAdd(node& n, V delta, offset len) {
+    n.sum += sum_type(delta) * sum_type(len);
+    n.min += delta;
+    n.max += delta;
+    if (n.left != none)
+      n.pendingAdd += delta;
+  }
+
+  // Give a node about to be partially updated children that reflect it
+  void pushDown(std::uint32_t index, K lo, K hi) {
+    const K mid = middle(lo, hi);
+    if (m_nodes[index].left == none) {
+      const V val = m_nodes[index].min;
+      const std::uint32_t left = allocate(uniform(val, length(lo, mid)));
+      const std::uint32_t right = allocate(uniform(val, length(mid, hi)));
+      m_nodes[index].left = left;
+      m_nodes[index].right = right;
+    }
+    else if (m_nodes[index].pendingAdd != V(0)) {
+      const V delta = m_nodes[index].pendingAdd;
+      applyAdd(m_nodes[m_nodes[index].left], delta, length(lo, mid));
+      applyAdd(m_nodes[m_nodes[index].right], delta, length(mid, hi));
+      m_nodes[index].pendingAdd = V(0);
+    }
+  }
+
+  void pullUp(std::uint32_t index) {
+    node& n = m_nodes[index];
+    const node& left = m_nodes[n.left];
+    const node& right = m_nodes[n.right];
+    n.sum = left.sum + right.sum;
+    n.min = std::min(left.min, right.min);
+    n.max = std::max(left.max, right.max);
+  }
+
+  template<bool Assign>
+  void update(std::uint32_t index, K lo, K hi, K updateBegin, K updateEnd, V val) {
+    if (!(updateBegin < hi) || !(lo < updateEnd))
+      return;
+
+    if (!(lo < updateBegin) && !(updateEnd < hi)) {
+      if (Assign) {
+        release(index);
+        m_nodes[index] = uniform(val, length(lo, hi));
+      }
+      else {
+        applyAdd(m_nodes[index], val, length(lo, hi));
+      }
+      return;
+    }
+
+    pushDown(index, lo, hi);
+    const K mid = middle(lo, hi);
+    update<Assign>(m_nodes[index].left, lo, mid, updateBegin, updateEnd, val);
+    update<Assign>(m_nodes[index].right, mid, hi, updateBegin, updateEnd, val);
+    pullUp(index);
+  }
+
+  // Aggregate over the part of [queryBegin, queryEnd) inside [lo, hi), which
+  // must overlap it, plus adds pending from the ancestors
+  aggregate_result query(std::uint32_t index, K lo, K hi, K queryBegin, K queryEnd, V carry) const {
+    const node& n = m_nodes[index];
+    if (!(lo < queryBegin) && !(queryEnd < hi))
+      return { n.sum + sum_type(carry) * sum_type(length(lo, hi)), V(n.min + carry), V(n.max + carry) };
+
+    if (n.left == none) {
+      const K overlapBegin = std::max(lo, queryBegin);
+      const K overlapEnd = std::min(hi, queryEnd);
+      const V val = V(n.min + carry);
+      return { sum_type(val) * sum_type(length(overlapBegin, overlapEnd)), val, val };
+    }
+
+    const K mid = middle(lo, hi);
+    carry += n.pendingAdd;
+    if (!(queryBegin < mid))
+      return query(n.right, mid, hi, queryBegin, queryEnd, carry);
+    if (!(mid < queryEnd))
+      return query(n.left, lo, mid, queryBegin, queryEnd, carry);
+
+    const aggregate_result left = query(n.left, lo, mid, queryBegin, queryEnd, carry);
+    const aggregate_result right = query(n.right, mid, hi, queryBegin, queryEnd, carry);
+    return { left.sum + right.sum, std::min(left.min, right.min), std::max(left.max, right.max) };
+  }
+
+public:
+  // Map every key of [domainBegin, domainEnd) to val. Throws
+  // std::invalid_argument if the domain is empty.
+  numeric_interval_map(V const& val, K const& domainBegin, K const& domainEnd)
+    : m_begin(domainBegin), m_end(domainEnd) {
+    if (!(domainBegin < domainEnd))
+      throw std::invalid_argument("numeric_interval_map needs a non-empty key domain");
+    m_nodes.push_back(uniform(val, length(domainBegin, domainEnd)));
+  }
+
+  // Assign value val to interval [keyBegin, keyEnd), clipped to the domain
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    update<true>(root, m_begin, m_end, keyBegin, keyEnd, val);
+  }
+
+  // Add delta to the value of every key in [keyBegin, keyEnd), clipped to
+  // the domain
+  void add(K const& keyBegin, K const& keyEnd, V const& delta) {
+    update<false>(root, m_begin, m_end, keyBegin, keyEnd, delta);
+  }
+
+  // Sum, minimum and maximum of the values of the keys in [keyBegin, keyEnd),
+  // clipped to the domain. Throws std::out_of_range if no key of the range
+  // is in the domain.
+  aggregate_result aggregate(K const& keyBegin, K const& keyEnd) const {
+    const K queryBegin = std::max(keyBegin, m_begin);
+    const K queryEnd = std::min(keyEnd, m_end);
+    if (!(queryBegin < queryEnd))
+      throw std::out_of_range("numeric_interval_map::aggregate over no keys of the domain");
+    return query(root, m_begin, m_end, queryBegin, queryEnd, V(0));
+  }
+
+  // look-up of the value associated with key. Throws std::out_of_range if key
+  // is outside the domain.
+  V operator[](K const& key) const {
+    if (key < m_begin || !(key < m_end))
+      throw std::out_of_range("numeric_interval_map key outside the domain");
+
+    K lo = m_begin;
+    K hi = m_end;
+    V carry = V(0);
+    std::uint32_t index = root;
+    while (m_nodes[index].left != none) {
+      const K mid = middle(lo, hi);
+      carry += m_nodes[index].pendingAdd;
+      if (key < mid) {
+        index = m_nodes[index].left;
+        hi = mid;
+      }
+      else {
+        index = m_nodes[index].right;
+        lo = mid;
+      }
+    }
+    return V(m_nodes[index].min + carry);
+  }
+
+  K domain_begin() const { return m_begin; }
+  K domain_end() const { return m_end; }
+
+  // Memory held by the tree. Freed nodes wait on a free list for reuse and
+  // count as slack, along with spare vector capacity.
+  interval_map_memory memory_usage() const {
+    interval_map_memory usage;
+    usage.values = (m_nodes.size() - m_free.size()) * sizeof(node);
+    usage.slack = (m_nodes.capacity() - m_nodes.size() + m_free.size()) * sizeof(node)
+      + m_free.capacity() * sizeof(std::uint32_t);
+    return usage;
+  }
+};
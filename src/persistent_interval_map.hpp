@@ -0,0 +1,160 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <utility>
+
+#include "interval_map_memory.hpp"
+#include "interval_map_treap.hpp"
+
+// interval_map whose copies share structure, for keeping many near-identical
+// maps, such as one per tenant derived from a common base. The boundaries are
+// kept in a treap (as augmented_interval_map's) of immutable, reference
+// counted nodes. Copying a map copies its root pointer in O(1), and assign
+// never changes a node: split and merge build new nodes along the paths they
+// walk and point them at the untouched subtrees, so an assign allocates
+// O(log n) nodes and the maps only pay for where they differ.
+//
+// Nodes are never modified after they're built, so a map may be read while
+// copies of it are modified on other threads.
+template<typename K, typename V>
+class persistent_interval_map {
+  struct node;
+  using link = std::shared_ptr<const node>;
+
+  struct node {
+    K key;
+    V val;
+    std::uint64_t priority;
+    link left;
+    link right;
+    // Boundaries in the subtree
+    std::size_t size;
+  };
+
+  link m_root;
+  interval_map_treap::priorities m_priorities;
+
+  // Nodes are never changed: split and merge join by building a copy of the
+  // node with its new children
+  struct hooks {
+    static void open(const node&) {}
+    static link join(const link& n, link left, link right) {
+      const std::size_t size = 1 + interval_map_treap::size_of(left) + interval_map_treap::size_of(right);
+      return std::make_shared<const node>(node{ n->key, n->val, n->priority, std::move(left), std::move(right), size });
+    }
+  };
+
+  link leaf(K const& key, V const& val) {
+    return std::make_shared<const node>(node{ key, val, m_priorities.next(), nullptr, nullptr, 1 });
+  }
+
+  // Split t into the boundaries before key and the rest, copying the nodes
+  // on the path. With keyGoesLeft, a boundary at key goes to the first part.
+  static std::pair<link, link> split(link t, K const& key, bool keyGoesLeft) {
+    return interval_map_treap::split<hooks>(std::move(t), key, keyGoesLeft);
+  }
+
+  // Join two trees, every key of a being less than every key of b, copying
+  // the nodes on the seam
+  static link merge(link a, link b) {
+    return interval_map_treap::merge<hooks>(std::move(a), std::move(b));
+  }
+
+  static const node* last(const node* t) { return interval_map_treap::rightmost(t); }
+
+  // Nodes reachable from n without passing through a node that is also
+  // referenced from elsewhere
+  static std::size_t countUnshared(const link& n) {
+    if (!n || n.use_count() > 1)
+      return 0;
+    return 1 + countUnshared(n->left) + countUnshared(n->right);
+  }
+
+  template<typename F>
+  static void forEach(const node* n, F& f) {
+    if (!n)
+      return;
+    forEach(n->left.get(), f);
+    f(n->key, n->val);
+    forEach(n->right.get(), f);
+  }
+
+public:
+  // constructor associates whole range of K with val by inserting (K_min, val)
+  persistent_interval_map(V const& val) {
+    m_root = leaf(std::numeric_limits<K>::lowest(), val);
+  }
+
+  // Assign value val to interval [keyBegin, keyEnd), as interval_map::assign.
+  // Nodes shared with copies of the map are left as they are.
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    // before: keys < keyBegin, covered: keys in [keyBegin, keyEnd], after: keys > keyEnd
+    auto outer = split(m_root, keyBegin, false);
+    auto inner = split(outer.second, keyEnd, true);
+    const link& before = outer.first;
+    const link& covered = inner.first;
+
+    // Only insert boundaries that actually change the value
+    const V endVal = last(covered ? covered.get() : before.get())->val;
+    const bool insertBegin = !before || !(last(before.get())->val == val);
+    const bool insertEnd = !(endVal == val);
+
+    link result = before;
+    if (insertBegin)
+      result = merge(result, leaf(keyBegin, val));
+    if (insertEnd)
+      result = merge(result, leaf(keyEnd, endVal));
+    m_root = merge(result, inner.second);
+  }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const {
+    const node* found = nullptr;
+    for (const node* n = m_root.get(); n;) {
+      if (key < n->key) {
+        n = n->left.get();
+      }
+      else {
+        found = n;
+        n = n->right.get();
+      }
+    }
+    return found->val;
+  }
+
+  // Number of boundaries, including the one at the lowest key
+  std::size_t size() const { return m_root->size; }
+
+  // Estimated memory held by this map alone. Nodes still shared with copies
+  // aren't counted, so a fresh copy reports nothing and grows with the
+  // changes made to it. Nodes are allocated with make_shared, which puts
+  // them in one block with the reference counts.
+  interval_map_memory memory_usage() const {
+    struct block {
+      void* vtable;
+      int useCount;
+      int weakCount;
+      node value;
+    };
+
+    interval_map_memory usage;
+    const std::size_t count = countUnshared(m_root);
+    usage.values = count * (sizeof(K) + sizeof(V));
+    usage.nodes = count * (sizeof(block) - sizeof(K) - sizeof(V));
+    usage.overhead = count * (interval_map_memory::heap_block(sizeof(block)) - sizeof(block));
+    return usage;
+  }
+
+  // Calls f(key, val) for every boundary in key order, for verifying
+  // canonical representation in tests
+  template<typename F>
+  void for_each_boundary(F&& f) const {
+    forEach(m_root.get(), f);
+  }
+};
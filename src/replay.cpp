@@ -0,0 +1,133 @@
+#include "interval_map.hpp"
+#include "seqlock_interval_map.hpp"
+#include "interval_map_trace.hpp"
+
+// Replays a trace recorded with recording_interval_map against a chosen
+// backend and reports how long it took
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <memory>
+#include <string>
+
+namespace {
+
+  struct options {
+    std::string path;
+    std::string backend = "map";
+    int repeat = 1;
+  };
+
+  // Print what interval_map's instrumentation saw, if it was compiled in
+  template<typename Map>
+  void printStats(const Map&) {}
+
+#ifdef INTERVAL_MAP_STATS
+  template<typename K, typename V>
+  void printStats(const interval_map<K, V>& map) {
+    const interval_map_stats stats = map.stats();
+    std::printf("  boundaries: %llu inserted, %llu erased, %llu coalesced; %llu no-op assigns\n",
+      (unsigned long long)stats.insertedBoundaries, (unsigned long long)stats.erasedBoundaries,
+      (unsigned long long)stats.coalescedBoundaries, (unsigned long long)stats.noopAssigns);
+    std::printf("  assign ns p50 <%llu p99 <%llu, lookup ns p50 <%llu p99 <%llu\n",
+      (unsigned long long)stats.assignLatency.quantile(0.5), (unsigned long long)stats.assignLatency.quantile(0.99),
+      (unsigned long long)stats.lookupLatency.quantile(0.5), (unsigned long long)stats.lookupLatency.quantile(0.99));
+  }
+#endif
+
+  template<typename Map, typename K, typename V>
+  void run(const options& opts, const interval_map_trace::reader<K, V>& in,
+      const std::vector<interval_map_trace::record<K, V>>& records) {
+    for (int i = 0; i < opts.repeat; ++i) {
+      // Fresh map every run so each replay starts from the recorded state
+      auto map = std::make_unique<Map>(in.initial_value());
+      const auto stats = interval_map_trace::replay(*map, records);
+      const double ns = double(stats.elapsed.count());
+      const std::uint64_t ops = stats.assigns + stats.lookups;
+      std::printf("%s run %d: %llu assigns, %llu lookups in %.3f ms, %.1f ns/op, lookup checksum %016llx\n",
+        opts.backend.c_str(), i + 1, (unsigned long long)stats.assigns, (unsigned long long)stats.lookups,
+        ns / 1e6, ops ? ns / ops : 0.0, (unsigned long long)stats.lookupChecksum);
+      printStats(*map);
+    }
+  }
+
+  template<typename K, typename V>
+  void replayTrace(const options& opts) {
+    interval_map_trace::reader<K, V> in(opts.path);
+    const auto records = interval_map_trace::read_all(in);
+
+    if (opts.backend == "map")
+      run<interval_map<K, V>>(opts, in, records);
+    else if (opts.backend == "seqlock")
+      run<seqlock_interval_map<K, V>>(opts, in, records);
+    else
+      throw std::runtime_error("unknown backend " + opts.backend);
+  }
+
+  // Traces store raw keys and values, so pick the matching integer types
+  template<typename K>
+  void dispatchVal(const options& opts, std::uint32_t valSize) {
+    switch (valSize) {
+    case 1: replayTrace<K, std::int8_t>(opts); break;
+    case 2: replayTrace<K, std::int16_t>(opts); break;
+    case 4: replayTrace<K, std::int32_t>(opts); break;
+    case 8: replayTrace<K, std::int64_t>(opts); break;
+    default: throw std::runtime_error("unsupported value size " + std::to_string(valSize));
+    }
+  }
+
+  void usage() {
+    std::fprintf(stderr,
+      "usage: interval_map_replay <trace> [--backend map|seqlock] [--repeat N]\n"
+      "  Keys and values are replayed as signed integers of the recorded sizes.\n");
+  }
+
+}
+
+int main(int argc, char** argv) {
+  options opts;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--backend" && i + 1 < argc)
+      opts.backend = argv[++i];
+    else if (arg == "--repeat" && i + 1 < argc)
+      opts.repeat = std::atoi(argv[++i]);
+    else if (opts.path.empty() && arg.compare(0, 2, "--") != 0)
+      opts.path = arg;
+    else {
+      usage();
+      return 1;
+    }
+  }
+  if (opts.path.empty()) {
+    usage();
+    return 1;
+  }
+
+  try {
+    // Peek at the header for the recorded sizes
+    interval_map_trace::file_header header{};
+    {
+      std::FILE* file = std::fopen(opts.path.c_str(), "rb");
+      if (!file || std::fread(&header, sizeof(header), 1, file) != 1) {
+        if (file)
+          std::fclose(file);
+        throw std::runtime_error("can't read " + opts.path);
+      }
+      std::fclose(file);
+    }
+
+    switch (header.keySize) {
+    case 4: dispatchVal<std::int32_t>(opts, header.valSize); break;
+    case 8: dispatchVal<std::int64_t>(opts, header.valSize); break;
+    default: throw std::runtime_error("unsupported key size " + std::to_string(header.keySize));
+    }
+  }
+  catch (const std::exception& e) {
+    std::fprintf(stderr, "interval_map_replay: %s\n", e.what());
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,240 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "interval_map_memory.hpp"
+
+// A trivially copyable T stored as atomic words, so that a seqlock reader
+// can copy it out while a writer overwrites it without a data race. The
+// words are loaded and stored one at a time with relaxed ordering; the
+// sequence counter's fences order them and tell readers whether the copy
+// they got is torn.
+template<typename T>
+class seqlock_slot {
+  using word = std::conditional_t<sizeof(T) % 8 == 0, std::uint64_t,
+    std::conditional_t<sizeof(T) % 4 == 0, std::uint32_t,
+    std::conditional_t<sizeof(T) % 2 == 0, std::uint16_t, std::uint8_t>>>;
+  static constexpr std::size_t wordCount = sizeof(T) / sizeof(word);
+
+  std::atomic<word> m_words[wordCount];
+
+public:
+  T load() const {
+    word words[wordCount];
+    for (std::size_t i = 0; i < wordCount; ++i)
+      words[i] = m_words[i].load(std::memory_order_relaxed);
+    // T needn't be default constructible, so copy into a union member
+    union holder {
+      unsigned char raw = 0;
+      T value;
+    } result;
+    std::memcpy(&result.value, words, sizeof(T));
+    return result.value;
+  }
+
+  void store(T const& value) {
+    word words[wordCount];
+    std::memcpy(words, &value, sizeof(T));
+    for (std::size_t i = 0; i < wordCount; ++i)
+      m_words[i].store(words[i], std::memory_order_relaxed);
+  }
+};
+
+// interval_map variant for small, read-mostly maps. Boundaries are stored in
+// fixed-capacity flat arrays guarded by a sequence lock: writers serialise on a
+// mutex and make the sequence counter odd while they modify the arrays, readers
+// only load the counter and retry if a write overlapped their lookup. Readers
+// never write to shared memory, so they don't contend with each other.
+template<typename K, typename V, std::size_t Capacity = 1024>
+class seqlock_interval_map {
+  // Readers copy keys and values out of the arrays while a writer may be
+  // modifying them, and discard the copy if the sequence changed. The slots
+  // are atomic words, so those overlapping accesses aren't data races.
+  static_assert(std::is_trivially_copyable<K>::value, "K must be trivially copyable");
+  static_assert(std::is_trivially_copyable<V>::value, "V must be trivially copyable");
+  static_assert(Capacity >= 2, "Capacity must allow at least one assigned interval");
+
+  // The sequence counter and size are all readers touch besides the arrays,
+  // so they share a cache line and keep away from the writer mutex
+  alignas(64) std::atomic<std::uint64_t> m_seq{ 0 };
+  std::atomic<std::size_t> m_size{ 0 };
+  alignas(64) std::mutex m_writeMutex;
+  alignas(64) seqlock_slot<K> m_keys[Capacity];
+  seqlock_slot<V> m_vals[Capacity];
+  // The constructor's value, which reset restores. Only writers read it.
+  V m_default;
+
+  void beginWrite() {
+    m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+  }
+
+  void endWrite() {
+    m_seq.store(m_seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+  }
+
+  void moveSlot(std::size_t from, std::size_t to) {
+    m_keys[to].store(m_keys[from].load());
+    m_vals[to].store(m_vals[from].load());
+  }
+
+  // Index of the first of the first size boundaries whose key isn't below
+  // key, as std::lower_bound, or with inclusive, is above it, as
+  // std::upper_bound
+  std::size_t search(K const& key, std::size_t size, bool inclusive) const {
+    std::size_t lo = 0;
+    std::size_t hi = size;
+    while (lo < hi) {
+      const std::size_t mid = lo + (hi - lo) / 2;
+      const K midKey = m_keys[mid].load();
+      if (inclusive ? !(key < midKey) : midKey < key)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    return lo;
+  }
+
+  // Run read (which must only copy out of the arrays) until it completes
+  // without a writer interfering
+  template<typename F>
+  auto readConsistent(F&& read) const {
+    for (;;) {
+      const std::uint64_t seq = m_seq.load(std::memory_order_acquire);
+      if (seq & 1) {
+        std::this_thread::yield();
+        continue;
+      }
+
+      auto result = read(m_size.load(std::memory_order_relaxed));
+
+      std::atomic_thread_fence(std::memory_order_acquire);
+      if (m_seq.load(std::memory_order_relaxed) == seq)
+        return result;
+    }
+  }
+
+public:
+  // constructor associates whole range of K with val
+  seqlock_interval_map(V const& val) : m_default(val) {
+    m_keys[0].store(std::numeric_limits<K>::lowest());
+    m_vals[0].store(val);
+    m_size.store(1, std::memory_order_release);
+  }
+
+  seqlock_interval_map(const seqlock_interval_map&) = delete;
+  seqlock_interval_map& operator=(const seqlock_interval_map&) = delete;
+
+  // Assign value val to interval [keyBegin, keyEnd), keeping the boundaries
+  // canonical. Throws std::length_error if the result wouldn't fit in Capacity
+  // boundaries, in which case the map is left unchanged.
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    const std::size_t size = m_size.load(std::memory_order_relaxed);
+
+    // Boundaries in [lo, hi) are those covered by [keyBegin, keyEnd]
+    const std::size_t lo = search(keyBegin, size, false);
+    const std::size_t hi = search(keyEnd, size, true);
+    const V endVal = m_vals[hi - 1].load();
+
+    // Only insert boundaries that actually change the value
+    const bool insertBegin = lo == 0 || !(m_vals[lo - 1].load() == val);
+    const bool insertEnd = !(endVal == val);
+    const std::size_t mid = lo + insertBegin + insertEnd;
+    const std::size_t newSize = mid + (size - hi);
+    if (newSize > Capacity)
+      throw std::length_error("seqlock_interval_map capacity exceeded");
+
+    // Move the boundaries after the interval to start at mid, one at a time,
+    // in the order that doesn't overwrite any before they're moved
+    beginWrite();
+    if (mid < hi) {
+      for (std::size_t from = hi; from < size; ++from)
+        moveSlot(from, from - hi + mid);
+    }
+    else if (hi < mid) {
+      for (std::size_t from = size; from-- > hi;)
+        moveSlot(from, from - hi + mid);
+    }
+    std::size_t i = lo;
+    if (insertBegin) {
+      m_keys[i].store(keyBegin);
+      m_vals[i].store(val);
+      ++i;
+    }
+    if (insertEnd) {
+      m_keys[i].store(keyEnd);
+      m_vals[i].store(endVal);
+    }
+    m_size.store(newSize, std::memory_order_relaxed);
+    endWrite();
+  }
+
+  // Map every key back to the value the map was constructed with
+  void reset() {
+    std::lock_guard<std::mutex> lock(m_writeMutex);
+    beginWrite();
+    m_keys[0].store(std::numeric_limits<K>::lowest());
+    m_vals[0].store(m_default);
+    m_size.store(1, std::memory_order_relaxed);
+    endWrite();
+  }
+
+  // look-up of the value associated with key. Returns a copy, as the stored
+  // value may be overwritten as soon as the lookup completes.
+  V operator[](K const& key) const {
+    return readConsistent([&](std::size_t size) {
+      // m_keys[0] is always the lowest key, so search the rest
+      std::size_t lo = 1;
+      std::size_t hi = size;
+      while (lo < hi) {
+        const std::size_t mid = lo + (hi - lo) / 2;
+        if (key < m_keys[mid].load())
+          hi = mid;
+        else
+          lo = mid + 1;
+      }
+      return m_vals[lo - 1].load();
+    });
+  }
+
+  // Consistent copy of the current boundaries, for verifying canonical
+  // representation in tests
+  std::vector<std::pair<K, V>> boundaries() const {
+    return readConsistent([&](std::size_t size) {
+      std::vector<std::pair<K, V>> result;
+      result.reserve(size);
+      for (std::size_t i = 0; i < size; ++i)
+        result.emplace_back(m_keys[i].load(), m_vals[i].load());
+      return result;
+    });
+  }
+
+  // Memory held by the map. The arrays are part of the object, so unused
+  // capacity shows up as slack and the sequence counter and mutex (with their
+  // padding) as overhead. The arrays can't shrink.
+  interval_map_memory memory_usage() const {
+    interval_map_memory usage;
+    const std::size_t count = size();
+    usage.values = count * (sizeof(K) + sizeof(V));
+    usage.slack = (Capacity - count) * (sizeof(K) + sizeof(V));
+    usage.overhead = sizeof(*this) - Capacity * (sizeof(K) + sizeof(V));
+    return usage;
+  }
+
+  std::size_t size() const { return m_size.load(std::memory_order_acquire); }
+  static constexpr std::size_t capacity() { return Capacity; }
+};
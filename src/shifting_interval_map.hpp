@@ -0,0 +1,278 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+
+#include "interval_map_treap.hpp"
+
+// interval_map over positions in a sequence, such as attributes of the
+// characters of a text buffer, where inserting or removing a span moves every
+// later boundary. With std::map that rewrites the whole tail; here the
+// boundaries are kept in a treap (as augmented_interval_map's) whose nodes
+// carry a shift still to be added to the keys of their children, so moving
+// every boundary after a position is one split, one tag and one merge, in
+// O(log n). Tags are pushed down as split and merge pass through nodes, and
+// lookups add them up on the way down.
+//
+// As with interval_map, the first boundary is at the lowest key and never
+// moves, and neighbouring boundaries never hold the same value. K must be
+// arithmetic to shift keys.
+template<typename K, typename V>
+class shifting_interval_map {
+  static_assert(std::is_arithmetic<K>::value, "K must be arithmetic to shift keys");
+
+  struct node {
+    K key;
+    V val;
+    std::uint64_t priority;
+    std::unique_ptr<node> left;
+    std::unique_ptr<node> right;
+    // Added to every key below this node, but not to its own
+    K shift;
+    // Boundaries in the subtree
+    std::size_t size;
+
+    node(K const& k, V const& v, std::uint64_t p) : key(k), val(v), priority(p), shift(0), size(1) {}
+  };
+
+  using link = std::unique_ptr<node>;
+
+  link m_root;
+  interval_map_treap::priorities m_priorities;
+
+  static void addShift(node* n, K const& delta) {
+    if (n) {
+      n->key += delta;
+      n->shift += delta;
+    }
+  }
+
+  static void refresh(node& n) {
+    n.size = 1 + interval_map_treap::size_of(n.left) + interval_map_treap::size_of(n.right);
+  }
+
+  static void pushDown(node& n) {
+    if (n.shift != K(0)) {
+      addShift(n.left.get(), n.shift);
+      addShift(n.right.get(), n.shift);
+      n.shift = K(0);
+    }
+  }
+
+  // Shifts are pushed down before children are moved, and joins recompute
+  // the subtree size
+  struct hooks {
+    static void open(node& n) { pushDown(n); }
+    static link join(link n, link left, link right) {
+      n->left = std::move(left);
+      n->right = std::move(right);
+      refresh(*n);
+      return n;
+    }
+  };
+
+  static std::pair<link, link> split(link t, K const& key, bool keyGoesLeft) {
+    return interval_map_treap::split<hooks>(std::move(t), key, keyGoesLeft);
+  }
+
+  static link merge(link a, link b) {
+    return interval_map_treap::merge<hooks>(std::move(a), std::move(b));
+  }
+
+  // Key and value of the first or last boundary of tree t, adding up shifts
+  // on the way
+  static std::pair<K, const V*> first(const node* t) {
+    K carry = K(0);
+    while (t->left) {
+      carry += t->shift;
+      t = t->left.get();
+    }
+    return { K(t->key + carry), &t->val };
+  }
+
+  static std::pair<K, const V*> last(const node* t) {
+    K carry = K(0);
+    while (t->right) {
+      carry += t->shift;
+      t = t->right.get();
+    }
+    return { K(t->key + carry), &t->val };
+  }
+
+  static link clone(const node* n) {
+    if (!n)
+      return nullptr;
+    link copy(new node(n->key, n->val, n->priority));
+    copy->shift = n->shift;
+    copy->left = clone(n->left.get());
+    copy->right = clone(n->right.get());
+    refresh(*copy);
+    return copy;
+  }
+
+  template<typename F>
+  static void forEach(const node* n, K carry, F& f) {
+    if (!n)
+      return;
+    forEach(n->left.get(), carry + n->shift, f);
+    f(K(n->key + carry), n->val);
+    forEach(n->right.get(), carry + n->shift, f);
+  }
+
+public:
+  // constructor associates whole range of K with val by inserting (K_min, val)
+  shifting_interval_map(V const& val) {
+    m_root.reset(new node(std::numeric_limits<K>::lowest(), val, m_priorities.next()));
+  }
+
+  shifting_interval_map(const shifting_interval_map& other)
+    : m_root(clone(other.m_root.get())) {}
+
+  shifting_interval_map& operator=(const shifting_interval_map& other) {
+    if (this != &other) {
+      m_root = clone(other.m_root.get());
+    }
+    return *this;
+  }
+
+  shifting_interval_map(shifting_interval_map&&) = default;
+  shifting_interval_map& operator=(shifting_interval_map&&) = default;
+
+  // Assign value val to interval [keyBegin, keyEnd), as interval_map::assign
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    // before: keys < keyBegin, covered: keys in [keyBegin, keyEnd], after: keys > keyEnd
+    auto outer = split(std::move(m_root), keyBegin, false);
+    auto inner = split(std::move(outer.second), keyEnd, true);
+    link before = std::move(outer.first);
+    link covered = std::move(inner.first);
+
+    // Only insert boundaries that actually change the value
+    const V endVal = *last(covered ? covered.get() : before.get()).second;
+    const bool insertBegin = !before || !(*last(before.get()).second == val);
+    const bool insertEnd = !(endVal == val);
+
+    covered.reset();
+
+    link result = std::move(before);
+    if (insertBegin)
+      result = merge(std::move(result), link(new node(keyBegin, val, m_priorities.next())));
+    if (insertEnd)
+      result = merge(std::move(result), link(new node(keyEnd, endVal, m_priorities.next())));
+    m_root = merge(std::move(result), std::move(inner.second));
+  }
+
+  // Open a gap of len keys at pos, moving every boundary at or after pos up
+  // by len, so [pos, pos + len) takes the value of the key before pos, as
+  // text typed at pos takes the attributes of the character before it.
+  // Throws std::out_of_range if a boundary would move past the highest key.
+  void insert_gap(K const& pos, K const& len) {
+    if (!(K(0) < len))
+      return;
+
+    // The boundary at the lowest key stays put
+    const bool atLowest = !(K(std::numeric_limits<K>::lowest()) < pos);
+    auto parts = split(std::move(m_root), pos, atLowest);
+    if (parts.second && std::numeric_limits<K>::max() - len < last(parts.second.get()).first) {
+      m_root = merge(std::move(parts.first), std::move(parts.second));
+      throw std::out_of_range("shifting_interval_map::insert_gap past the highest key");
+    }
+    addShift(parts.second.get(), len);
+    m_root = merge(std::move(parts.first), std::move(parts.second));
+  }
+
+  // Remove the len keys of [pos, pos + len), moving every boundary after
+  // them down by len, so pos takes the value pos + len had. Throws
+  // std::out_of_range if pos + len is past the highest key.
+  void remove_span(K const& pos, K const& len) {
+    if (!(K(0) < len))
+      return;
+    if (std::numeric_limits<K>::max() - len < pos)
+      throw std::out_of_range("shifting_interval_map::remove_span past the highest key");
+    const K end = pos + len;
+    const V endVal = (*this)[end];
+
+    // before: keys < pos, removed: keys in [pos, end], after: keys > end
+    auto outer = split(std::move(m_root), pos, false);
+    auto inner = split(std::move(outer.second), end, true);
+    link before = std::move(outer.first);
+    inner.first.reset();
+    addShift(inner.second.get(), K(-len));
+
+    if (!before || !(*last(before.get()).second == endVal))
+      before = merge(std::move(before), link(new node(pos, endVal, m_priorities.next())));
+    m_root = merge(std::move(before), std::move(inner.second));
+  }
+
+  // Split off the boundaries at or after key into a new map, as
+  // augmented_interval_map::split_at, in O(log n)
+  shifting_interval_map split_at(K const& key) {
+    auto parts = split(std::move(m_root), key, false);
+    if (!parts.first) {
+      // key is the lowest key, so everything goes to the upper part
+      shifting_interval_map upper(*first(parts.second.get()).second);
+      upper.m_root = std::move(parts.second);
+      m_root.reset(new node(std::numeric_limits<K>::lowest(), *first(upper.m_root.get()).second, m_priorities.next()));
+      return upper;
+    }
+
+    m_root = std::move(parts.first);
+    shifting_interval_map upper(*last(m_root.get()).second);
+    upper.m_root = merge(std::move(upper.m_root), std::move(parts.second));
+    return upper;
+  }
+
+  // The map holding a's values below the first boundary of b after its
+  // lowest key, and b's from there on, as augmented_interval_map's concat,
+  // in O(log n)
+  friend shifting_interval_map concat(shifting_interval_map a, shifting_interval_map b) {
+    auto rest = split(std::move(b.m_root), std::numeric_limits<K>::lowest(), true);
+    b.m_root = std::move(rest.first);
+    if (!rest.second)
+      return a;
+    const auto seam = first(rest.second.get());
+    if (!(last(a.m_root.get()).first < seam.first))
+      throw std::invalid_argument("concat of shifting_interval_maps whose boundaries overlap");
+
+    // Keep the seam canonical
+    if (*seam.second == *last(a.m_root.get()).second)
+      rest.second = split(std::move(rest.second), seam.first, true).second;
+    a.m_root = merge(std::move(a.m_root), std::move(rest.second));
+    return a;
+  }
+
+  // look-up of the value associated with key
+  V const& operator[](K const& key) const {
+    const node* found = nullptr;
+    K carry = K(0);
+    for (const node* n = m_root.get(); n;) {
+      if (key < K(n->key + carry)) {
+        carry += n->shift;
+        n = n->left.get();
+      }
+      else {
+        found = n;
+        carry += n->shift;
+        n = n->right.get();
+      }
+    }
+    return found->val;
+  }
+
+  // Number of boundaries, including the one at the lowest key
+  std::size_t size() const { return m_root->size; }
+
+  // Calls f(key, val) for every boundary in key order, for verifying
+  // canonical representation in tests
+  template<typename F>
+  void for_each_boundary(F&& f) const {
+    forEach(m_root.get(), K(0), f);
+  }
+};
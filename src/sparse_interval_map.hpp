@@ -0,0 +1,317 @@
+#pragma once
+
+#include <algorithm>
+#include <cstddef>
+#include <iterator>
+#include <limits>
+#include <optional>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "interval_map_memory.hpp"
+#include "interval_segments.hpp"
+
+template<typename K, typename V>
+class sparse_interval_map;
+
+template<typename K, typename A, typename B, typename F>
+auto combine(const sparse_interval_map<K, A>& a, const sparse_interval_map<K, B>& b, F f);
+
+// interval_map variant for maps that are mostly the default value. Only the
+// intervals holding other values are stored, as sorted [keyBegin, keyEnd)
+// entries in a flat vector, so an island of a non-default value costs one
+// entry instead of two boundaries and the default needs no entry at all.
+//
+// The representation is canonical: entries never hold the default value, and
+// entries that touch never hold the same value. Like seqlock_interval_map,
+// assign moves the entries after the assigned interval, so it suits maps that
+// are read far more than they're written. K only needs operator< and V only
+// operator==.
+template<typename K, typename V>
+class sparse_interval_map {
+public:
+  struct entry {
+    K keyBegin;
+    K keyEnd;
+    V val;
+  };
+
+private:
+  V m_default;
+  std::vector<entry> m_entries;
+
+  // Neither a < b nor b < a
+  static bool equivalent(K const& a, K const& b) {
+    return !(a < b) && !(b < a);
+  }
+
+public:
+  // Cursor over the boundaries of the map, gaps included. A gap is the run of
+  // the default ending at entry m_index; the one before the first entry has
+  // no key, and the one after the last entry no end. There is no gap before
+  // an entry starting at the lowest key, which is then the first run itself.
+  // The end is the entry past the last one.
+  class cursor {
+    const sparse_interval_map* m_map = nullptr;
+    std::size_t m_index = 0;
+    bool m_gap = true;
+
+    bool hasGap(std::size_t index) const {
+      const auto& entries = m_map->m_entries;
+      if (index == 0)
+        return entries.empty() || std::numeric_limits<K>::lowest() < entries[0].keyBegin;
+      return index == entries.size() || !equivalent(entries[index - 1].keyEnd, entries[index].keyBegin);
+    }
+
+  public:
+    cursor() = default;
+    cursor(const sparse_interval_map* map, std::size_t index, bool gap) : m_map(map), m_index(index), m_gap(gap) {}
+
+    // The first run has no key, so this must not be called on it
+    K const& key() const {
+      return m_gap ? m_map->m_entries[m_index - 1].keyEnd : m_map->m_entries[m_index].keyBegin;
+    }
+
+    V const& value() const {
+      return m_gap ? m_map->m_default : m_map->m_entries[m_index].val;
+    }
+
+    bool is_first() const { return m_index == 0 && (m_gap || !hasGap(0)); }
+
+    cursor& operator++() {
+      if (m_gap)
+        m_gap = false;
+      else
+        m_gap = hasGap(++m_index);
+      return *this;
+    }
+
+    cursor& operator--() {
+      if (m_gap) {
+        --m_index;
+        m_gap = false;
+      }
+      else if (hasGap(m_index)) {
+        m_gap = true;
+      }
+      else {
+        --m_index;
+      }
+      return *this;
+    }
+
+    bool operator==(const cursor& other) const { return m_index == other.m_index && m_gap == other.m_gap; }
+    bool operator!=(const cursor& other) const { return !(*this == other); }
+  };
+
+private:
+  // The first run, which is the gap before the first entry unless that
+  // starts at the lowest key
+  cursor first() const {
+    return cursor(this, 0, m_entries.empty() || std::numeric_limits<K>::lowest() < m_entries[0].keyBegin);
+  }
+
+  // The entry or gap holding key, found with one search
+  cursor containing(K const& key) const {
+    const std::size_t index = std::partition_point(m_entries.begin(), m_entries.end(), [&](const entry& e) {
+      return !(key < e.keyBegin);
+    }) - m_entries.begin();
+    if (index == 0)
+      return cursor(this, 0, true);
+    if (key < m_entries[index - 1].keyEnd)
+      return cursor(this, index - 1, false);
+    return cursor(this, index, true);
+  }
+
+public:
+  // constructor associates whole range of K with val
+  sparse_interval_map(V const& val) : m_default(val) {}
+
+  // Bulk construction from (key, value) boundaries sorted by strictly
+  // increasing key, as interval_map's. Keys below the first boundary map to
+  // val, which stays the default. Runs of the default become gaps and equal
+  // neighbours are merged, in one linear pass. Throws std::invalid_argument
+  // if the last boundary doesn't map to the default, as the run it starts
+  // would be unbounded.
+  template<typename It>
+  sparse_interval_map(V const& val, It first, It last) : m_default(val) {
+    std::optional<entry> open;
+    for (; first != last; ++first) {
+      if (open && open->val == first->second)
+        continue;
+      if (open) {
+        open->keyEnd = first->first;
+        m_entries.push_back(std::move(*open));
+        open.reset();
+      }
+      if (!(first->second == m_default))
+        open = entry{ first->first, first->first, first->second };
+    }
+    if (open)
+      throw std::invalid_argument("the last boundary of a sparse_interval_map must map to the default");
+  }
+
+  // Assign value val to interval [keyBegin, keyEnd), as interval_map::assign
+  void assign(K const& keyBegin, K const& keyEnd, V const& val) {
+    if (!(keyBegin < keyEnd))
+      return;
+
+    // Entries in [first, last) overlap [keyBegin, keyEnd)
+    auto first = std::partition_point(m_entries.begin(), m_entries.end(), [&](const entry& e) {
+      return !(keyBegin < e.keyEnd);
+    });
+    auto last = std::partition_point(first, m_entries.end(), [&](const entry& e) {
+      return e.keyBegin < keyEnd;
+    });
+
+    // Parts of the overlapped entries sticking out of the interval survive
+    std::optional<entry> left;
+    std::optional<entry> right;
+    if (first != last && first->keyBegin < keyBegin)
+      left = entry{ first->keyBegin, keyBegin, first->val };
+    if (first != last && keyEnd < std::prev(last)->keyEnd)
+      right = entry{ keyEnd, std::prev(last)->keyEnd, std::prev(last)->val };
+
+    // Merge the new entry with equal valued neighbours it touches
+    std::optional<entry> middle;
+    if (!(val == m_default)) {
+      middle = entry{ keyBegin, keyEnd, val };
+      if (left && left->val == val) {
+        middle->keyBegin = left->keyBegin;
+        left.reset();
+      }
+      else if (!left && first != m_entries.begin() && equivalent(std::prev(first)->keyEnd, keyBegin)
+          && std::prev(first)->val == val) {
+        --first;
+        middle->keyBegin = first->keyBegin;
+      }
+
+      if (right && right->val == val) {
+        middle->keyEnd = right->keyEnd;
+        right.reset();
+      }
+      else if (!right && last != m_entries.end() && equivalent(last->keyBegin, keyEnd) && last->val == val) {
+        middle->keyEnd = last->keyEnd;
+        ++last;
+      }
+    }
+
+    auto pos = m_entries.erase(first, last);
+    if (right)
+      pos = m_entries.insert(pos, std::move(*right));
+    if (middle)
+      pos = m_entries.insert(pos, std::move(*middle));
+    if (left)
+      m_entries.insert(pos, std::move(*left));
+  }
+
+  // Combine other into this map pointwise, setting the value of every key k
+  // to f((*this)[k], other[k]). The entries of both maps are swept together
+  // in O(n + m) and the result is built into a new array.
+  template<typename B, typename F>
+  void combine(const sparse_interval_map<K, B>& other, F f) {
+    *this = ::combine(*this, other, f);
+  }
+
+  // First and end cursors over all boundaries, gaps included
+  std::pair<cursor, cursor> boundary_cursors() const {
+    return { first(), cursor(this, m_entries.size(), false) };
+  }
+
+  // Map every key back to the default. The entries' memory is kept for
+  // reuse; shrink_to_fit releases it.
+  void reset() {
+    m_entries.clear();
+  }
+
+  // The segments of [lo, hi), clipped to it, as interval_map::segments. Runs
+  // of the default between entries are segments too.
+  segment_view<K, V, cursor> segments(K const& lo, K const& hi) const {
+    cursor first = containing(lo);
+    if (!(lo < hi))
+      return { first, first, lo, hi };
+    cursor last = containing(hi);
+    if (last.is_first() || last.key() < hi)
+      ++last;
+    return { first, last, lo, hi };
+  }
+
+  // The run of a single value holding key, found with one search. Runs of
+  // the default between entries count as runs.
+  interval_run<K, V> segment_containing(K const& key) const {
+    return run_at<K, V>(containing(key), first(), cursor(this, m_entries.size(), false));
+  }
+
+  // The run after the one holding key, as interval_map::next_change
+  std::optional<interval_run<K, V>> next_change(K const& key) const {
+    const cursor end(this, m_entries.size(), false);
+    cursor it = containing(key);
+    if (++it == end)
+      return std::nullopt;
+    return run_at<K, V>(it, first(), end);
+  }
+
+  // The run before the one holding key, as interval_map::prev_change
+  std::optional<interval_run<K, V>> prev_change(K const& key) const {
+    cursor it = containing(key);
+    if (it.is_first())
+      return std::nullopt;
+    return run_at<K, V>(--it, first(), cursor(this, m_entries.size(), false));
+  }
+
+  // look-up of the value associated with key. One search finds the last entry
+  // starting at or before key; if key is past its end, it's in a gap.
+  V const& operator[](K const& key) const {
+    auto it = std::partition_point(m_entries.begin(), m_entries.end(), [&](const entry& e) {
+      return !(key < e.keyBegin);
+    });
+    if (it == m_entries.begin() || !(key < std::prev(it)->keyEnd))
+      return m_default;
+    return std::prev(it)->val;
+  }
+
+  // Memory held by the entries. Spare capacity of the vector is slack, which
+  // shrink_to_fit gives back.
+  interval_map_memory memory_usage() const {
+    interval_map_memory usage;
+    usage.values = m_entries.size() * sizeof(entry);
+    usage.slack = (m_entries.capacity() - m_entries.size()) * sizeof(entry);
+    if (m_entries.capacity() > 0) {
+      const std::size_t allocated = m_entries.capacity() * sizeof(entry);
+      usage.overhead = interval_map_memory::heap_block(allocated) - allocated;
+    }
+    return usage;
+  }
+
+  // Release spare capacity, for instance after a bulk reset to the default
+  void shrink_to_fit() {
+    m_entries.shrink_to_fit();
+  }
+
+  V const& default_value() const { return m_default; }
+
+  // The stored intervals in key order, for verifying canonical representation
+  // in tests
+  const std::vector<entry>& entries() const { return m_entries; }
+};
+
+// The pointwise combination of a and b: every key k maps to f(a[k], b[k]),
+// and the default to f of the defaults. Both entry arrays are swept together,
+// so this takes O(n + m).
+template<typename K, typename A, typename B, typename F>
+auto combine(const sparse_interval_map<K, A>& a, const sparse_interval_map<K, B>& b, F f) {
+  using R = std::decay_t<decltype(f(std::declval<A const&>(), std::declval<B const&>()))>;
+
+  std::vector<std::pair<K, R>> boundaries;
+  boundaries.reserve(2 * (a.entries().size() + b.entries().size()));
+  const auto aCursors = a.boundary_cursors();
+  const auto bCursors = b.boundary_cursors();
+  sweep_boundaries(aCursors.first, aCursors.second, bCursors.first, bCursors.second,
+    [&](const K* key, A const& aVal, B const& bVal) {
+      // The first run holds an entry if either map has one at the lowest key
+      boundaries.emplace_back(key ? *key : std::numeric_limits<K>::lowest(), f(aVal, bVal));
+    });
+  return sparse_interval_map<K, R>(f(a.default_value(), b.default_value()), boundaries.begin(), boundaries.end());
+}
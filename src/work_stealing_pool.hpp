@@ -0,0 +1,158 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed-size thread pool where each worker owns a task deque. Workers pop their
+// own tasks LIFO and steal from the front of other workers' deques when they
+// run dry, so uneven chunks of work balance themselves out.
+class work_stealing_pool {
+  struct worker_queue {
+    std::mutex mutex;
+    std::deque<std::function<void()>> tasks;
+  };
+
+  std::vector<std::unique_ptr<worker_queue>> m_queues;
+  std::vector<std::thread> m_threads;
+  std::atomic<std::size_t> m_pending{ 0 };
+  std::atomic<std::size_t> m_nextQueue{ 0 };
+  std::mutex m_sleepMutex;
+  std::condition_variable m_wake;
+  bool m_stop = false;
+
+  void push(std::function<void()> task) {
+    // Count the task before it can be popped, so m_pending never drops
+    // below zero. A worker woken early just finds nothing and waits again.
+    {
+      std::lock_guard<std::mutex> lock(m_sleepMutex);
+      m_pending.fetch_add(1, std::memory_order_release);
+    }
+    auto& queue = *m_queues[m_nextQueue.fetch_add(1, std::memory_order_relaxed) % m_queues.size()];
+    {
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      queue.tasks.push_back(std::move(task));
+    }
+    m_wake.notify_one();
+  }
+
+  // Pop from the back of our own queue, or steal from the front of another.
+  // Threads that aren't workers pass self == m_queues.size() and only steal.
+  bool tryPop(std::size_t self, std::function<void()>& task) {
+    if (self < m_queues.size()) {
+      auto& queue = *m_queues[self];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.back());
+        queue.tasks.pop_back();
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    for (std::size_t i = 1; i <= m_queues.size(); ++i) {
+      auto& queue = *m_queues[(self + i) % m_queues.size()];
+      std::lock_guard<std::mutex> lock(queue.mutex);
+      if (!queue.tasks.empty()) {
+        task = std::move(queue.tasks.front());
+        queue.tasks.pop_front();
+        m_pending.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+      }
+    }
+
+    return false;
+  }
+
+  void workerLoop(std::size_t self) {
+    for (;;) {
+      std::function<void()> task;
+      if (tryPop(self, task)) {
+        task();
+        continue;
+      }
+
+      std::unique_lock<std::mutex> lock(m_sleepMutex);
+      m_wake.wait(lock, [this]() { return m_stop || m_pending.load(std::memory_order_acquire) > 0; });
+      if (m_stop && m_pending.load(std::memory_order_acquire) == 0)
+        return;
+    }
+  }
+
+public:
+  explicit work_stealing_pool(std::size_t threads = std::thread::hardware_concurrency()) {
+    if (threads == 0)
+      threads = 1;
+
+    for (std::size_t i = 0; i < threads; ++i)
+      m_queues.push_back(std::make_unique<worker_queue>());
+    for (std::size_t i = 0; i < threads; ++i)
+      m_threads.emplace_back([this, i]() { workerLoop(i); });
+  }
+
+  ~work_stealing_pool() {
+    {
+      std::lock_guard<std::mutex> lock(m_sleepMutex);
+      m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& thread : m_threads)
+      thread.join();
+  }
+
+  work_stealing_pool(const work_stealing_pool&) = delete;
+  work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+  std::size_t size() const { return m_threads.size(); }
+
+  // Run body(i) for every i in [0, count) and wait for all of them to finish.
+  // The calling thread helps run tasks while it waits, so parallel_for may be
+  // nested inside a task. The first exception thrown by body is rethrown here.
+  template<typename F>
+  void parallel_for(std::size_t count, F&& body) {
+    if (count == 0)
+      return;
+
+    std::size_t remaining = count;
+    std::exception_ptr error;
+    std::mutex doneMutex;
+    std::condition_variable done;
+
+    for (std::size_t i = 0; i < count; ++i) {
+      push([&, i]() {
+        std::exception_ptr thrown;
+        try {
+          body(i);
+        }
+        catch (...) {
+          thrown = std::current_exception();
+        }
+        // Notify under the lock, as the waiter's locals go away once it sees
+        // remaining reach zero
+        std::lock_guard<std::mutex> lock(doneMutex);
+        if (thrown && !error)
+          error = thrown;
+        if (--remaining == 0)
+          done.notify_all();
+      });
+    }
+
+    // Help until there's nothing left to pop. Every task of ours has then
+    // been taken by a thread that will finish it, so block until they have.
+    std::function<void()> task;
+    while (tryPop(m_queues.size(), task))
+      task();
+    std::unique_lock<std::mutex> lock(doneMutex);
+    done.wait(lock, [&]() { return remaining == 0; });
+
+    if (error)
+      std::rethrow_exception(error);
+  }
+};